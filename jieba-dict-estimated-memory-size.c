@@ -5,6 +5,15 @@ static const char * const jieba_dict[] = {
 #include "dict.h"
 };
 
+static const size_t jieba_dict_len[] = {
+#include "dict-len.h"
+};
+
 int main() {
-  printf("%zu", jieba_estimate_memory_size(sizeof(jieba_dict)/sizeof(jieba_dict[0])));
+  static struct jieba_word_counts counts;
+  jieba_count_words(
+      (const unsigned char *const *)jieba_dict, jieba_dict_len,
+      sizeof(jieba_dict)/sizeof(jieba_dict[0]), &counts
+  );
+  printf("%zu", jieba_exact_memory_size(&counts));
 }
@@ -0,0 +1,13 @@
+#include "jieba.h"
+#include "jieba-dict.h"
+#include <stdio.h>
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : "jieba-dict.img";
+  init_jieba_dict();
+  if (jieba_dict_save(path) != JIEBA_SAVE_SUCCESS) {
+    fprintf(stderr, "saving jieba-dict to %s fail\n", path);
+    return 1;
+  }
+  return 0;
+}
@@ -3,6 +3,66 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+/*
+ * The dictionary could be built, frozen and saved by jieba-dict-image at
+ * build time, then the saved image is embedded in read only data, and the
+ * initialization only points to it.
+ */
+#ifndef JIEBA_DICT_IMAGE
+# define JIEBA_DICT_IMAGE 0
+#endif
+
+#ifndef JIEBA_DICT_IMAGE_FILE
+# define JIEBA_DICT_IMAGE_FILE "jieba-dict.img"
+#endif
+
+static struct jieba_data_base jieba_dict_data_base;
+
+#if JIEBA_DICT_IMAGE
+# define JIEBA_DICT__STR2(x) #x
+# define JIEBA_DICT__STR(x) JIEBA_DICT__STR2(x)
+# define JIEBA_DICT__SYMBOL(name) JIEBA_DICT__STR(__USER_LABEL_PREFIX__) #name
+# ifdef __APPLE__
+#  define JIEBA_DICT__RODATA ".const\n"
+#  define JIEBA_DICT__HIDDEN ".private_extern "
+# else
+#  define JIEBA_DICT__RODATA ".section .rodata\n"
+#  define JIEBA_DICT__HIDDEN ".hidden "
+# endif
+
+__asm__(
+    JIEBA_DICT__RODATA
+    ".balign 64\n"
+    ".globl " JIEBA_DICT__SYMBOL(jieba_dict_image) "\n"
+    JIEBA_DICT__HIDDEN JIEBA_DICT__SYMBOL(jieba_dict_image) "\n"
+    JIEBA_DICT__SYMBOL(jieba_dict_image) ":\n"
+    ".incbin \"" JIEBA_DICT_IMAGE_FILE "\"\n"
+    ".globl " JIEBA_DICT__SYMBOL(jieba_dict_image_end) "\n"
+    JIEBA_DICT__HIDDEN JIEBA_DICT__SYMBOL(jieba_dict_image_end) "\n"
+    JIEBA_DICT__SYMBOL(jieba_dict_image_end) ":\n"
+    ".text\n"
+);
+
+extern const unsigned char jieba_dict_image[], jieba_dict_image_end[];
+
+void init_jieba_dict(void) {
+  enum jieba_load_result res;
+  res = jieba_load_data_base_image(
+      &jieba_dict_data_base, jieba_dict_image,
+      jieba_dict_image_end - jieba_dict_image
+  );
+  if (res != JIEBA_LOAD_SUCCESS) {
+    fprintf(stderr, "jieba-dict initialization fail, bad image\n");
+    exit(-1);
+  }
+}
+
+/* the embedded image is already shared by all processes */
+void init_jieba_dict_shared(const char *name) {
+  (void)name;
+  init_jieba_dict();
+}
+#else
 static const char * const jieba_dict[] = {
 #include "dict.h"
 };
@@ -12,26 +72,110 @@ static const size_t jieba_dict_len[] = {
 };
 
 #ifndef JIEBA_DICT_MEM
-# define JIEBA_DICT_MEM (37302416)
+# define JIEBA_DICT_MEM (14579375)
+#endif
+
+/*
+ * The words are only staged, and the table of a length is built when a
+ * separation first needs it, so the lengths never met cost nothing.
+ */
+#ifndef JIEBA_DICT_LAZY
+# define JIEBA_DICT_LAZY 0
+#endif
+
+/* the dictionary never changes, so it is frozen once it is built */
+#ifndef JIEBA_DICT_FREEZE
+# define JIEBA_DICT_FREEZE !JIEBA_DICT_LAZY
 #endif
 
+#if JIEBA_DICT_FREEZE || JIEBA_DICT_LAZY
+static unsigned char *jieba_dict_mem;
+#else
 static unsigned char jieba_dict_mem[JIEBA_DICT_MEM];
+#endif
 
-static struct jieba_data_base jieba_dict_data_base;
+#if JIEBA_DICT_FREEZE
+static void freeze_jieba_dict(void) {
+  struct jieba_data_base frozen;
+  size_t size = jieba_freeze_memory_size(&jieba_dict_data_base);
+  unsigned char *frozen_mem = malloc(size);
+  if (frozen_mem == NULL) {
+    fprintf(stderr, "jieba-dict freezing fail, no mem\n");
+    exit(-1);
+  }
+
+  enum jieba_freeze_result res;
+  res = jieba_freeze_data_base(
+      &jieba_dict_data_base, &frozen, frozen_mem, size, NULL
+  );
+  if (res != JIEBA_FREEZE_SUCCESS) {
+    fprintf(stderr, "jieba-dict freezing fail\n");
+    exit(-1);
+  }
+
+  /* the memory behind the frozen data base is only used while freezing */
+  free(jieba_dict_mem);
+  jieba_dict_mem = realloc(frozen_mem, frozen.whole_memory_size);
+  if (jieba_dict_mem == NULL) jieba_dict_mem = frozen_mem;
+  frozen.whole_memory = (char *)jieba_dict_mem;
+  frozen.root = (struct jieba__data_base *)jieba_dict_mem;
+  jieba_dict_data_base = frozen;
+}
+#endif
 
 void init_jieba_dict(void) {
   size_t dict_len = sizeof(jieba_dict) / sizeof(jieba_dict[0]);
 
+  /* sizes the data base for exactly the words of the dictionary */
+  static struct jieba_word_counts counts;
+  jieba_count_words(
+      (const unsigned char *const *)jieba_dict, jieba_dict_len, dict_len,
+      &counts
+  );
+
+#if JIEBA_DICT_FREEZE || JIEBA_DICT_LAZY
+# if JIEBA_DICT_LAZY
+  size_t mem_size = jieba_lazy_memory_size(&counts);
+# else
+  size_t mem_size = jieba_exact_memory_size(&counts);
+# endif
+  jieba_dict_mem = malloc(mem_size);
+  if (jieba_dict_mem == NULL) {
+    fprintf(stderr, "jieba-dict initialization fail, no mem\n");
+    exit(-1);
+  }
+#else
+  size_t mem_size = JIEBA_DICT_MEM;
+#endif
+
   enum jieba_init_result res;
-  res = jieba_init_data_base(
-      &jieba_dict_data_base, jieba_dict_mem, JIEBA_DICT_MEM,
-      sizeof(jieba_dict) / sizeof(jieba_dict[0]), NULL
+#if JIEBA_DICT_LAZY
+  res = jieba_init_data_base_lazily(
+      &jieba_dict_data_base, jieba_dict_mem, mem_size, &counts, NULL
+  );
+#else
+  res = jieba_init_data_base_exactly(
+      &jieba_dict_data_base, jieba_dict_mem, mem_size, &counts, NULL
   );
+#endif
   if (res != JIEBA_INIT_SUCCESS) {
     fprintf(stderr, "jieba-dict initialization fail");
     exit(-1);
   }
 
+#if JIEBA_DICT_LAZY
+  size_t failed;
+  if (jieba_stage_words(
+          (const unsigned char *const *)jieba_dict, jieba_dict_len, dict_len,
+          &jieba_dict_data_base, &failed
+      ) != JIEBA_ADD_WORD_SUCCESS) {
+    fprintf(
+        stderr, "jieba-dict initialization fail, bad word %s\n",
+        jieba_dict[failed]
+    );
+    exit(-1);
+  }
+#else
   for (size_t i = 0; i < dict_len; i++) {
     enum jieba_add_word_result res;
     res = jieba_add_word(
@@ -54,6 +198,9 @@ void init_jieba_dict(void) {
     case JIEBA_ADD_WORD_NO_ENOUGH_CHARACTER:
       fprintf(stderr, "jieba-dict initialization fail, no enough chars\n");
       exit(-1);
+    case JIEBA_ADD_WORD_FAIL_FROZEN:
+      fprintf(stderr, "jieba-dict initialization fail, frozen\n");
+      exit(-1);
     case JIEBA_ADD_WORD_FAIL_ALREADY_EXISTS:
       fprintf(
           stderr, "WARNING: word %s presents multiple times in the dictionary\n",
@@ -62,6 +209,41 @@ void init_jieba_dict(void) {
       break;
     }
   }
+#endif
+
+#if JIEBA_DICT_FREEZE
+  freeze_jieba_dict();
+#endif
+}
+
+/*
+ * The first process builds the dictionary and shares it, the others attach
+ * to it. A dictionary that is not frozen could not be shared, and is kept.
+ */
+void init_jieba_dict_shared(const char *name) {
+  if (jieba_load_shared_data_base(&jieba_dict_data_base, name)
+      == JIEBA_LOAD_SUCCESS)
+    return;
+
+  init_jieba_dict();
+  /* another process may have shared its dictionary meanwhile */
+  enum jieba_save_result res;
+  res = jieba_save_shared_data_base(&jieba_dict_data_base, name);
+  if (res != JIEBA_SAVE_SUCCESS && res != JIEBA_SAVE_FAIL_EXISTS) return;
+
+  struct jieba_data_base shared;
+  if (jieba_load_shared_data_base(&shared, name) != JIEBA_LOAD_SUCCESS)
+    return;
+#if JIEBA_DICT_FREEZE
+  free(jieba_dict_mem);
+  jieba_dict_mem = NULL;
+#endif
+  jieba_dict_data_base = shared;
+}
+#endif
+
+enum jieba_save_result jieba_dict_save(const char *path) {
+  return jieba_save_data_base(&jieba_dict_data_base, path);
 }
 
 enum jieba_separate_result
@@ -70,3 +252,13 @@ jieba_dict_separate(
 ) {
   return jieba_separate(str, strsize, word_size, &jieba_dict_data_base);
 }
+
+enum jieba_separate_result
+jieba_dict_separate_sentence(
+    const unsigned char *restrict str, size_t strsize,
+    size_t *restrict word_sizes, size_t *restrict word_count
+) {
+  return jieba_separate_sentence(
+      str, strsize, word_sizes, word_count, &jieba_dict_data_base
+  );
+}
@@ -5,9 +5,22 @@
 
 void init_jieba_dict(void);
 
+/* shares the dictionary in the POSIX shared memory segment `name` */
+void init_jieba_dict_shared(const char *name);
+
 enum jieba_separate_result
 jieba_dict_separate(
     const unsigned char *str, size_t strsize, size_t *word_size
 );
 
+/* see jieba_separate_sentence */
+enum jieba_separate_result
+jieba_dict_separate_sentence(
+    const unsigned char *restrict str, size_t strsize,
+    size_t *restrict word_sizes, size_t *restrict word_count
+);
+
+/* the dictionary is saved only if it is frozen, see jieba_save_data_base */
+enum jieba_save_result jieba_dict_save(const char *path);
+
 #endif
@@ -1,6 +1,35 @@
 #include "jieba-dict.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* the same defaults as jieba.c, to know what a data base keeps */
+#ifndef JIEBA_WORD_INFO
+# define JIEBA_WORD_INFO 1
+#endif
+#ifndef JIEBA_DOUBLE_ARRAY_TRIE
+# define JIEBA_DOUBLE_ARRAY_TRIE 0
+#endif
+#ifndef JIEBA_BLOOM_FILTER
+# define JIEBA_BLOOM_FILTER 1
+#endif
+#ifndef JIEBA_MAX_WORD_LENGTH
+# define JIEBA_MAX_WORD_LENGTH 32
+#endif
+#ifndef JIEBA_MMAP
+# if defined(__unix__) || defined(__APPLE__)
+#  define JIEBA_MMAP 1
+# else
+#  define JIEBA_MMAP 0
+# endif
+#endif
+#define TEST_WORD_INFO (JIEBA_WORD_INFO && !JIEBA_DOUBLE_ARRAY_TRIE)
+#define TEST_BLOOM_FILTER (JIEBA_BLOOM_FILTER && !JIEBA_DOUBLE_ARRAY_TRIE)
+#define TEST_MMAP JIEBA_MMAP
+
+#if TEST_MMAP
+# include <sys/mman.h>
+#endif
 
 char data[] = "新华社北京1月6日电 1月6日，中国共产党中央委员会致电祝贺老挝人民革命党第十二次全国代表大会召开。贺电说：\n"
 "老挝人民革命党是老挝人民和老挝社会主义事业的坚强领导核心。老挝党十一大以来，以通伦总书记为首的老挝党中央致力于加强党的自身建设、巩固党的领导地位，团结带领老挝各族人民，积极探索符合自身国情的社会主义发展道路，推动党和国家各项事业取得一系列重要发展成就。我们对此感到由衷高兴并予以积极评价。\n"
@@ -14,6 +43,905 @@ void print_word(char *str, size_t n) {
   puts("");
 }
 
+#define CHECK(cond)\
+  do {\
+    if (!(cond)) {\
+      fprintf(stderr, "%s:%d: check fail: %s\n", __FILE__, __LINE__, #cond);\
+      exit(1);\
+    }\
+  } while (0)
+
+/* the words of the small data bases the checks below build */
+static const char *const test_words[] = {
+  "中国", "共产党", "中国共产党", "老挝", "人民", "革命", "革命党", "社会",
+  "社会主义", "事业", "发展", "两国", "合作", "伙伴", "合作伙伴", "关系"
+};
+
+#define TEST_WORD_COUNT (sizeof(test_words) / sizeof(test_words[0]))
+/* every length takes hash table nodes of its own, which few words miss */
+#define TEST_ESTIMATED_WORD_COUNT 1024
+
+static void init_test_data_base(struct jieba_data_base *data_base) {
+  size_t size = jieba_estimate_memory_size(TEST_ESTIMATED_WORD_COUNT);
+  void *memory = malloc(size);
+  CHECK(memory != NULL);
+  CHECK(jieba_init_data_base(
+      data_base, memory, size, TEST_ESTIMATED_WORD_COUNT, NULL
+  ) == JIEBA_INIT_SUCCESS);
+  for (size_t i = 0; i < TEST_WORD_COUNT; i++) {
+    CHECK(jieba_add_word(
+        (unsigned char *)test_words[i], strlen(test_words[i]), data_base
+    ) == JIEBA_ADD_WORD_SUCCESS);
+  }
+}
+
+/* sized exactly for the words, which are added */
+static void init_exact_data_base(
+    struct jieba_data_base *data_base, const char *const *words,
+    size_t word_count
+) {
+  struct jieba_word_counts counts;
+  memset(&counts, 0, sizeof(counts));
+  for (size_t i = 0; i < word_count; i++) {
+    const unsigned char *word = (const unsigned char *)words[i];
+    size_t word_size = strlen(words[i]);
+    jieba_count_words(&word, &word_size, 1, &counts);
+  }
+  size_t size = jieba_exact_memory_size(&counts);
+  void *memory = malloc(size);
+  CHECK(memory != NULL);
+  CHECK(jieba_init_data_base_exactly(data_base, memory, size, &counts, NULL)
+        == JIEBA_INIT_SUCCESS);
+  for (size_t i = 0; i < word_count; i++) {
+    CHECK(jieba_add_word(
+        (unsigned char *)words[i], strlen(words[i]), data_base
+    ) == JIEBA_ADD_WORD_SUCCESS);
+  }
+}
+
+/* both find the test words only, and separate the text the same way */
+static void check_same_words(
+    struct jieba_data_base *expected, struct jieba_data_base *data_base
+) {
+  for (size_t i = 0; i < TEST_WORD_COUNT; i++) {
+    const unsigned char *word = (const unsigned char *)test_words[i];
+    CHECK(jieba_find_word(word, strlen(test_words[i]), expected, NULL));
+    CHECK(jieba_find_word(word, strlen(test_words[i]), data_base, NULL));
+  }
+  CHECK(!jieba_find_word((const unsigned char *)"中央", 6, data_base, NULL));
+  /* a trie walks through it to 中国共产党, but it is no word */
+  CHECK(!jieba_find_word(
+      (const unsigned char *)"中国共产", 12, data_base, NULL
+  ));
+
+  /* the hashes of all the prefixes are taken, and the longest word wins */
+  size_t longest;
+  CHECK(jieba_separate(
+      (const unsigned char *)"中国共产党员", 18, &longest, data_base
+  ) == JIEBA_SEPARATE_SUCCESS);
+  CHECK(longest == 15);
+
+  const unsigned char *str = (const unsigned char *)data;
+  size_t size = strlen(data);
+  while (size != 0) {
+    size_t expected_size, word_size;
+    CHECK(jieba_separate(str, size, &expected_size, expected)
+          == JIEBA_SEPARATE_SUCCESS);
+    CHECK(jieba_separate(str, size, &word_size, data_base)
+          == JIEBA_SEPARATE_SUCCESS);
+    CHECK(word_size == expected_size);
+    str += word_size;
+    size -= word_size;
+  }
+}
+
+static void *read_file(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  CHECK(file != NULL);
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  void *content = malloc(*size);
+  CHECK(content != NULL && fread(content, *size, 1, file) == 1);
+  fclose(file);
+  return content;
+}
+
+static void write_file(const char *path, const void *content, size_t size) {
+  FILE *file = fopen(path, "wb");
+  CHECK(file != NULL && fwrite(content, size, 1, file) == 1);
+  CHECK(fclose(file) == 0);
+}
+
+/* a frozen data base saved, loaded back, and broken */
+static void test_save_and_load(void) {
+  const char *path = "jieba-test.img";
+  struct jieba_data_base live, frozen, loaded;
+  init_test_data_base(&live);
+  size_t size = jieba_freeze_memory_size(&live);
+  void *memory = malloc(size);
+  CHECK(memory != NULL);
+  CHECK(jieba_freeze_data_base(&live, &frozen, memory, size, NULL)
+        == JIEBA_FREEZE_SUCCESS);
+  check_same_words(&live, &frozen);
+
+  CHECK(jieba_save_data_base(&live, path) == JIEBA_SAVE_FAIL_NOT_FROZEN);
+  CHECK(jieba_save_data_base(&frozen, path) == JIEBA_SAVE_SUCCESS);
+  size_t image_size;
+  unsigned char *image = read_file(path, &image_size);
+  CHECK(jieba_load_data_base_image(&loaded, image, image_size)
+        == JIEBA_LOAD_SUCCESS);
+  check_same_words(&live, &loaded);
+  /* an image in memory is only forgotten, it is still there to load */
+  CHECK(!loaded.mapped);
+  jieba_unload_data_base(&loaded);
+  CHECK(jieba_load_data_base_image(&loaded, image, image_size)
+        == JIEBA_LOAD_SUCCESS);
+#if TEST_MMAP
+  CHECK(jieba_load_data_base(&loaded, path) == JIEBA_LOAD_SUCCESS);
+  CHECK(loaded.mapped);
+  check_same_words(&live, &loaded);
+  jieba_unload_data_base(&loaded);
+
+  /* the last byte is in the checksum, which only files are checked by */
+  image[image_size - 1] ^= 1;
+  write_file(path, image, image_size);
+  CHECK(jieba_load_data_base(&loaded, path) == JIEBA_LOAD_FAIL_BAD_IMAGE);
+  image[image_size - 1] ^= 1;
+#else
+  CHECK(jieba_load_data_base(&loaded, path) == JIEBA_LOAD_FAIL_IO);
+#endif
+  image[0] ^= 1;
+  CHECK(jieba_load_data_base_image(&loaded, image, image_size)
+        == JIEBA_LOAD_FAIL_BAD_IMAGE);
+#if TEST_MMAP
+  write_file(path, image, image_size);
+  CHECK(jieba_load_data_base(&loaded, path) == JIEBA_LOAD_FAIL_BAD_IMAGE);
+#endif
+  image[0] ^= 1;
+  remove(path);
+
+#if TEST_MMAP
+  const char *name = "/jieba-test";
+  shm_unlink(name);
+  CHECK(jieba_save_shared_data_base(&frozen, name) == JIEBA_SAVE_SUCCESS);
+  CHECK(jieba_save_shared_data_base(&frozen, name) == JIEBA_SAVE_FAIL_EXISTS);
+  CHECK(jieba_load_shared_data_base(&loaded, name) == JIEBA_LOAD_SUCCESS);
+  check_same_words(&live, &loaded);
+  jieba_unload_data_base(&loaded);
+  shm_unlink(name);
+#endif
+
+  free(image);
+  free(memory);
+  free(live.whole_memory);
+}
+
+/* the word is found with the frequency and the tag */
+static void check_word_info(
+    const char *word, size_t frequency, const char *tag,
+    struct jieba_data_base *data_base
+) {
+  struct jieba_word_info info;
+  CHECK(jieba_find_word(
+      (const unsigned char *)word, strlen(word), data_base, &info
+  ));
+#if TEST_WORD_INFO
+  CHECK(info.frequency == frequency);
+  CHECK(strncmp(info.tag, tag, sizeof(info.tag)) == 0);
+#else
+  (void)frequency; (void)tag;
+#endif
+}
+
+/* a word of 3 characters for every i below 8000 ^ 3 */
+static size_t make_word(size_t i, unsigned char *word) {
+  for (size_t n = 0; n < 3; n++, i /= 8000) {
+    unsigned int code_point = 0x4e00 + i % 8000;
+    word[n * 3] = 0xe0 | code_point >> 12;
+    word[n * 3 + 1] = 0x80 | (code_point >> 6 & 0x3f);
+    word[n * 3 + 2] = 0x80 | (code_point & 0x3f);
+  }
+  return 9;
+}
+
+static void test_add_dictionary(void) {
+  struct jieba_data_base data_base;
+  init_test_data_base(&data_base);
+
+  const char *text =
+    "甲乙 3 n\r\n"
+    "丙丁\n"
+    "\n"
+    "戊己\tns\r\n"
+    "庚辛 99999999999 v\n"
+    "子丑  7\t\tnrfg";
+  size_t failed_line = 0;
+  CHECK(jieba_add_dictionary(text, strlen(text), &data_base, &failed_line)
+        == JIEBA_LOAD_DICTIONARY_SUCCESS);
+  check_word_info("甲乙", 3, "n", &data_base);
+  check_word_info("丙丁", 0, "", &data_base);
+  check_word_info("戊己", 0, "ns", &data_base);
+  check_word_info("庚辛", 4294967295u, "v", &data_base);
+  check_word_info("子丑", 7, "nrfg", &data_base);
+  CHECK(!jieba_find_word((const unsigned char *)"甲乙 ", 7, &data_base, NULL));
+
+  /* lines are numbered from 1, empty ones too, the words before stay */
+  const char *long_tag = "寅卯 1 n\n\n辰巳 2 abcde\n午未 3 n\n";
+  CHECK(jieba_add_dictionary(
+      long_tag, strlen(long_tag), &data_base, &failed_line
+  ) == JIEBA_LOAD_DICTIONARY_FAIL_BAD_LINE);
+  CHECK(failed_line == 3);
+  check_word_info("寅卯", 1, "n", &data_base);
+  CHECK(!jieba_find_word((const unsigned char *)"午未", 6, &data_base, NULL));
+
+  const char *more_fields = "申酉 1 n x\r\n";
+  CHECK(jieba_add_dictionary(
+      more_fields, strlen(more_fields), &data_base, &failed_line
+  ) == JIEBA_LOAD_DICTIONARY_FAIL_BAD_LINE);
+  CHECK(failed_line == 1);
+
+  const char *bad_word = "戌亥 1\n\xff\xfe 2\n";
+  CHECK(jieba_add_dictionary(
+      bad_word, strlen(bad_word), &data_base, NULL
+  ) == JIEBA_LOAD_DICTIONARY_FAIL_ADD_WORD);
+  check_word_info("戌亥", 1, "", &data_base);
+
+  free(data_base.whole_memory);
+}
+
+/*
+ * The data base is filled until words fail, so its tables are full, and
+ * their overflow or stash cells are moved as well.
+ */
+static void test_compact(void) {
+  enum { WORD_COUNT = 40000 };
+  static char added[WORD_COUNT];
+  struct jieba_data_base data_base;
+  size_t size = jieba_estimate_memory_size(WORD_COUNT / 4);
+  void *memory = malloc(size);
+  CHECK(memory != NULL);
+  CHECK(jieba_init_data_base(&data_base, memory, size, WORD_COUNT / 4, NULL)
+        == JIEBA_INIT_SUCCESS);
+
+  unsigned char word[9];
+  size_t added_count = 0;
+  for (size_t i = 0; i < WORD_COUNT; i++) {
+    enum jieba_add_word_result res;
+    res = jieba_add_word(word, make_word(i * 7919, word), &data_base);
+    CHECK(res == JIEBA_ADD_WORD_SUCCESS || res == JIEBA_ADD_WORD_FAIL_NOMEM);
+    added[i] = res == JIEBA_ADD_WORD_SUCCESS;
+    added_count += added[i];
+  }
+  CHECK(added_count != 0 && added_count != WORD_COUNT);
+
+  /* a word is found again wherever its probe ended */
+  for (size_t i = 0; i < WORD_COUNT; i++) {
+    if (!added[i]) continue;
+    CHECK(jieba_add_word(word, make_word(i * 7919, word), &data_base)
+          == JIEBA_ADD_WORD_FAIL_ALREADY_EXISTS);
+  }
+
+  size_t released = jieba_compact(&data_base);
+  CHECK(data_base.whole_memory_size + released == size);
+  for (size_t i = 0; i < WORD_COUNT; i++) {
+    size_t word_size = make_word(i * 7919, word), separated;
+    CHECK(jieba_find_word(word, word_size, &data_base, NULL) == added[i]);
+    CHECK(jieba_separate(word, word_size, &separated, &data_base)
+          == JIEBA_SEPARATE_SUCCESS);
+    CHECK((separated == word_size) == added[i]);
+  }
+
+  free(memory);
+}
+
+/*
+ * Cells and trie units are taken from where they were never used, and only
+ * cleared then, so memory full of garbage makes no difference.
+ */
+static void test_dirty_memory(void) {
+  struct jieba_data_base expected, data_base;
+  init_test_data_base(&expected);
+  size_t size = jieba_estimate_memory_size(TEST_ESTIMATED_WORD_COUNT);
+  void *memory = malloc(size);
+  CHECK(memory != NULL);
+  memset(memory, 0xa5, size);
+  CHECK(jieba_init_data_base(
+      &data_base, memory, size, TEST_ESTIMATED_WORD_COUNT, NULL
+  ) == JIEBA_INIT_SUCCESS);
+  for (size_t i = 0; i < TEST_WORD_COUNT; i++) {
+    CHECK(jieba_add_word(
+        (unsigned char *)test_words[i], strlen(test_words[i]), &data_base
+    ) == JIEBA_ADD_WORD_SUCCESS);
+  }
+  check_same_words(&expected, &data_base);
+
+  free(expected.whole_memory);
+  free(memory);
+}
+
+/*
+ * A data base sized exactly for words of 1 to 3 characters, with a few
+ * duplicates, takes them all, and a byte less is refused. The trie is
+ * still estimated, so it may not.
+ */
+static void test_exact_memory_size(void) {
+  enum { WORD_COUNT = 3000 };
+  static unsigned char word_bytes[WORD_COUNT][9];
+  const unsigned char *words[WORD_COUNT];
+  size_t word_sizes[WORD_COUNT];
+  for (size_t i = 0; i < WORD_COUNT; i++) {
+    /* the last words are the first ones again */
+    size_t j = i < WORD_COUNT - 100 ? i : i - (WORD_COUNT - 100);
+    words[i] = word_bytes[i];
+    word_sizes[i] = make_word(j * 7919, word_bytes[i]) / 3 * (j % 3 + 1);
+  }
+
+  struct jieba_word_counts counts;
+  memset(&counts, 0, sizeof(counts));
+  jieba_count_words(words, word_sizes, WORD_COUNT, &counts);
+  size_t size = jieba_exact_memory_size(&counts), required = 0;
+  void *memory = malloc(size);
+  CHECK(memory != NULL);
+  struct jieba_data_base data_base;
+  CHECK(jieba_init_data_base_exactly(
+      &data_base, memory, size - 1, &counts, &required
+  ) == JIEBA_INIT_FAIL_NOMEM);
+  CHECK(required == size);
+  CHECK(jieba_init_data_base_exactly(&data_base, memory, size, &counts, NULL)
+        == JIEBA_INIT_SUCCESS);
+  for (size_t i = 0; i < WORD_COUNT; i++) {
+    enum jieba_add_word_result res;
+    res = jieba_add_word(word_bytes[i], word_sizes[i], &data_base);
+#if JIEBA_DOUBLE_ARRAY_TRIE
+    /* the trie is still estimated */
+    if (res == JIEBA_ADD_WORD_FAIL_NOMEM) break;
+#endif
+    CHECK(res == JIEBA_ADD_WORD_SUCCESS ||
+          res == JIEBA_ADD_WORD_FAIL_ALREADY_EXISTS);
+  }
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+  for (size_t i = 0; i < WORD_COUNT; i++)
+    CHECK(jieba_find_word(words[i], word_sizes[i], &data_base, NULL));
+#endif
+
+  free(memory);
+}
+
+/*
+ * The words added at once, some already there, are found and separate
+ * the text as the ones added one by one, and a bad word stops them.
+ */
+static void test_add_words(void) {
+  enum { WORD_COUNT = 600 };
+  static unsigned char word_bytes[WORD_COUNT][9];
+  const unsigned char *words[TEST_WORD_COUNT + WORD_COUNT];
+  size_t word_sizes[TEST_WORD_COUNT + WORD_COUNT];
+  struct jieba_data_base expected, data_base;
+  init_test_data_base(&expected);
+  init_test_data_base(&data_base);
+  for (size_t i = 0; i < TEST_WORD_COUNT; i++) {
+    words[i] = (const unsigned char *)test_words[i];
+    word_sizes[i] = strlen(test_words[i]);
+  }
+  for (size_t i = 0; i < WORD_COUNT; i++) {
+    words[TEST_WORD_COUNT + i] = word_bytes[i];
+    word_sizes[TEST_WORD_COUNT + i] = make_word(i * 7919, word_bytes[i]);
+    CHECK(jieba_add_word(word_bytes[i], 9, &expected)
+          == JIEBA_ADD_WORD_SUCCESS);
+  }
+
+  size_t failed_word = 0;
+  CHECK(jieba_add_words(
+      words, word_sizes, TEST_WORD_COUNT + WORD_COUNT, &data_base,
+      &failed_word
+  ) == JIEBA_ADD_WORD_SUCCESS);
+  check_same_words(&expected, &data_base);
+  for (size_t i = 0; i < WORD_COUNT; i++)
+    CHECK(jieba_find_word(word_bytes[i], 9, &data_base, NULL));
+
+  words[1] = (const unsigned char *)"\xff\xfe";
+  word_sizes[1] = 2;
+  CHECK(jieba_add_words(words, word_sizes, 2, &data_base, &failed_word)
+        == JIEBA_ADD_WORD_BAD_UTF8);
+  CHECK(failed_word == 1);
+  check_same_words(&expected, &data_base);
+
+  free(expected.whole_memory);
+  free(data_base.whole_memory);
+}
+
+/*
+ * The words added on threads are found and separate the text as the ones
+ * added one by one, and a bad word fails as for jieba_add_words.
+ */
+static void test_add_words_parallel(void) {
+  struct jieba_data_base expected, data_base;
+  init_test_data_base(&expected);
+  size_t size = jieba_estimate_memory_size(TEST_ESTIMATED_WORD_COUNT);
+  void *memory = malloc(size);
+  CHECK(memory != NULL);
+  CHECK(jieba_init_data_base(
+      &data_base, memory, size, TEST_ESTIMATED_WORD_COUNT, NULL
+  ) == JIEBA_INIT_SUCCESS);
+
+  /* more characters than any word may have, whatever the longest is */
+  unsigned char too_long[65 * 3];
+  for (size_t i = 0; i < 65; i++) memcpy(&too_long[i * 3], "长", 3);
+  const unsigned char *words[TEST_WORD_COUNT + 2];
+  size_t word_sizes[TEST_WORD_COUNT + 2];
+  for (size_t i = 0; i < TEST_WORD_COUNT; i++) {
+    words[i] = (const unsigned char *)test_words[i];
+    word_sizes[i] = strlen(test_words[i]);
+  }
+  words[TEST_WORD_COUNT] = too_long;
+  word_sizes[TEST_WORD_COUNT] = sizeof(too_long);
+  words[TEST_WORD_COUNT + 1] = (const unsigned char *)"中央";
+  word_sizes[TEST_WORD_COUNT + 1] = 6;
+
+  size_t failed_word = 0;
+  CHECK(jieba_add_words_parallel(
+      words, word_sizes, TEST_WORD_COUNT + 2, &data_base, 4, &failed_word
+  ) == JIEBA_ADD_WORD_FAIL_TOO_LONG);
+  CHECK(failed_word == TEST_WORD_COUNT);
+  check_same_words(&expected, &data_base);
+
+  words[0] = (const unsigned char *)"\xff\xfe";
+  word_sizes[0] = 2;
+  CHECK(jieba_add_words_parallel(
+      words, word_sizes, TEST_WORD_COUNT, &data_base, 4, &failed_word
+  ) == JIEBA_ADD_WORD_BAD_UTF8);
+  CHECK(failed_word == 0);
+  check_same_words(&expected, &data_base);
+
+  free(expected.whole_memory);
+  free(memory);
+}
+
+/* words of characters of every utf 8 size are matched byte for byte */
+static void test_character_sizes(void) {
+  static const char *const words[] = { "ab", "é文", "𠀀字", "a𠀀é文" };
+  struct jieba_data_base data_base;
+  init_test_data_base(&data_base);
+  for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+    CHECK(jieba_add_word(
+        (unsigned char *)words[i], strlen(words[i]), &data_base
+    ) == JIEBA_ADD_WORD_SUCCESS);
+
+  for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+    const unsigned char *word = (const unsigned char *)words[i];
+    size_t word_size;
+    CHECK(jieba_find_word(word, strlen(words[i]), &data_base, NULL));
+    CHECK(jieba_separate(word, strlen(words[i]), &word_size, &data_base)
+          == JIEBA_SEPARATE_SUCCESS);
+    CHECK(word_size == strlen(words[i]));
+  }
+  /* the same code points in another order, or a character cut short */
+  CHECK(!jieba_find_word((const unsigned char *)"文é", 5, &data_base, NULL));
+  CHECK(!jieba_find_word((const unsigned char *)"𠀀字", 6, &data_base, NULL));
+  size_t word_size;
+  CHECK(jieba_separate(
+      (const unsigned char *)"a𠀀é", 7, &word_size, &data_base
+  ) == JIEBA_SEPARATE_SUCCESS);
+  CHECK(word_size == 1);
+
+  free(data_base.whole_memory);
+}
+
+/*
+ * Words around the packed lengths, of code points of all 21 bits, differ
+ * from each other only in their last character.
+ */
+static void test_packed_words(void) {
+  static const char *const words[] = {
+    "一\xf4\x8f\xbf\xbf", "一二三", "一二三四", "一二三四五六",
+    "一二三四五六七"
+  };
+  static const char *const others[] = {
+    "一\xf4\x8f\xbf\xbe", "一二四", "一二三五", "一二三四五七",
+    "一二三四五六八"
+  };
+  struct jieba_data_base data_base;
+  init_exact_data_base(&data_base, words, sizeof(words) / sizeof(words[0]));
+  for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+    CHECK(jieba_find_word(
+        (const unsigned char *)words[i], strlen(words[i]), &data_base, NULL
+    ));
+    CHECK(!jieba_find_word(
+        (const unsigned char *)others[i], strlen(others[i]), &data_base, NULL
+    ));
+  }
+
+  free(data_base.whole_memory);
+}
+
+/*
+ * The longest word, of 4 bytes characters, keeps its whole size in its hash
+ * cell, and a character more is too long.
+ */
+static void test_longest_word(void) {
+  unsigned char word[(JIEBA_MAX_WORD_LENGTH + 1) * 4];
+  for (size_t i = 0; i <= JIEBA_MAX_WORD_LENGTH; i++)
+    memcpy(&word[i * 4], "𠀀", 4);
+  size_t longest_size = JIEBA_MAX_WORD_LENGTH * 4, word_size;
+
+  /* a length takes hash table nodes of its own, so it is counted */
+  const unsigned char *words[1] = { word };
+  struct jieba_word_counts counts;
+  memset(&counts, 0, sizeof(counts));
+  jieba_count_words(words, &longest_size, 1, &counts);
+  size_t size = jieba_exact_memory_size(&counts);
+  void *memory = malloc(size);
+  CHECK(memory != NULL);
+  struct jieba_data_base data_base;
+  CHECK(jieba_init_data_base_exactly(&data_base, memory, size, &counts, NULL)
+        == JIEBA_INIT_SUCCESS);
+  CHECK(jieba_add_word(word, sizeof(word), &data_base)
+        == JIEBA_ADD_WORD_FAIL_TOO_LONG);
+  CHECK(jieba_add_word(word, longest_size, &data_base)
+        == JIEBA_ADD_WORD_SUCCESS);
+  CHECK(jieba_find_word(word, longest_size, &data_base, NULL));
+  CHECK(!jieba_find_word(word, longest_size - 4, &data_base, NULL));
+  CHECK(jieba_separate(word, sizeof(word), &word_size, &data_base)
+        == JIEBA_SEPARATE_SUCCESS);
+  CHECK(word_size == longest_size);
+
+  free(memory);
+}
+
+/*
+ * A table starts empty and doubles as it fills, all the words added before
+ * are found after every doubling.
+ */
+static void test_table_doubling(void) {
+  enum { WORD_COUNT = 4096 };
+  struct jieba_data_base data_base;
+  size_t size = jieba_estimate_memory_size(WORD_COUNT * 2);
+  void *memory = malloc(size);
+  CHECK(memory != NULL);
+  CHECK(jieba_init_data_base(&data_base, memory, size, WORD_COUNT * 2, NULL)
+        == JIEBA_INIT_SUCCESS);
+
+  unsigned char word[9];
+  for (size_t added = 1; added <= WORD_COUNT; added++) {
+    CHECK(jieba_add_word(word, make_word(added * 7919, word), &data_base)
+          == JIEBA_ADD_WORD_SUCCESS);
+    if ((added & (added - 1)) != 0) continue;
+    for (size_t i = 1; i <= added; i++)
+      CHECK(jieba_find_word(word, make_word(i * 7919, word), &data_base, NULL));
+    CHECK(!jieba_find_word(
+        word, make_word((added + 1) * 7919, word), &data_base, NULL
+    ));
+  }
+
+  free(memory);
+}
+
+/*
+ * The rate is 0 for an empty filter and grows with the words, far beyond
+ * the words it is sized for, and it is 1 with no filter to check.
+ */
+static void test_bloom_filter(void) {
+  struct jieba_data_base data_base;
+  size_t size = jieba_estimate_memory_size(TEST_ESTIMATED_WORD_COUNT);
+  void *memory = malloc(size);
+  CHECK(memory != NULL);
+  CHECK(jieba_init_data_base(
+      &data_base, memory, size, TEST_ESTIMATED_WORD_COUNT, NULL
+  ) == JIEBA_INIT_SUCCESS);
+  CHECK(jieba_bloom_filter_false_positive_rate(&data_base)
+        == (TEST_BLOOM_FILTER ? 0 : 1));
+
+  /* words keep being added until the memory runs out */
+  unsigned char word[9];
+  size_t added = 0;
+  double last = 0;
+  for (size_t i = 0; added < TEST_ESTIMATED_WORD_COUNT * 4; i++) {
+    enum jieba_add_word_result res;
+    res = jieba_add_word(word, make_word(i * 7919, word), &data_base);
+    CHECK(res == JIEBA_ADD_WORD_SUCCESS || res == JIEBA_ADD_WORD_FAIL_NOMEM);
+    if (res != JIEBA_ADD_WORD_SUCCESS) break;
+    added += 1;
+    if (added == 16 || added == TEST_ESTIMATED_WORD_COUNT) {
+      double rate = jieba_bloom_filter_false_positive_rate(&data_base);
+#if TEST_BLOOM_FILTER
+      CHECK(rate > last && rate < (added == 16 ? 0.0001 : 0.01));
+#else
+      CHECK(rate == 1);
+#endif
+      last = rate;
+    }
+  }
+  CHECK(added >= TEST_ESTIMATED_WORD_COUNT);
+  double rate = jieba_bloom_filter_false_positive_rate(&data_base);
+  CHECK(TEST_BLOOM_FILTER ? rate > last && rate < 1 : rate == 1);
+
+  free(memory);
+}
+
+/*
+ * Only the page of 中 has length masks, so the words starting on the other
+ * pages are looked up with every length, and still found.
+ */
+static void test_length_mask_pages(void) {
+  struct jieba_data_base expected, data_base;
+  init_test_data_base(&expected);
+
+  const unsigned char *words[TEST_WORD_COUNT];
+  size_t word_sizes[TEST_WORD_COUNT];
+  for (size_t i = 0; i < TEST_WORD_COUNT; i++) {
+    words[i] = (const unsigned char *)test_words[i];
+    word_sizes[i] = strlen(test_words[i]);
+  }
+  struct jieba_word_counts counts;
+  memset(&counts, 0, sizeof(counts));
+  jieba_count_words(words, word_sizes, TEST_WORD_COUNT, &counts);
+  memset(counts.first_character_pages, 0, sizeof(counts.first_character_pages));
+  counts.first_character_pages[0x4e / 8] = 1 << 0x4e % 8;
+
+  size_t size = jieba_exact_memory_size(&counts);
+  void *memory = malloc(size);
+  CHECK(memory != NULL);
+  CHECK(jieba_init_data_base_exactly(&data_base, memory, size, &counts, NULL)
+        == JIEBA_INIT_SUCCESS);
+  for (size_t i = 0; i < TEST_WORD_COUNT; i++)
+    CHECK(jieba_add_word(
+        (unsigned char *)test_words[i], word_sizes[i], &data_base
+    ) == JIEBA_ADD_WORD_SUCCESS);
+  check_same_words(&expected, &data_base);
+
+  free(expected.whole_memory);
+  free(memory);
+}
+
+/*
+ * The longest word first gives 研究生/命, the words of the highest
+ * probability are 研究/生命.
+ */
+static void test_separate_sentence(void) {
+  struct jieba_data_base data_base;
+  size_t size = jieba_estimate_memory_size(TEST_ESTIMATED_WORD_COUNT);
+  void *memory = malloc(size);
+  CHECK(memory != NULL);
+  CHECK(jieba_init_data_base(
+      &data_base, memory, size, TEST_ESTIMATED_WORD_COUNT, NULL
+  ) == JIEBA_INIT_SUCCESS);
+  const char *dictionary = "研究 1000\n研究生 10\n生命 1000\n生 100000\n";
+  CHECK(jieba_add_dictionary(
+      dictionary, strlen(dictionary), &data_base, NULL
+  ) == JIEBA_LOAD_DICTIONARY_SUCCESS);
+
+  const unsigned char *str = (const unsigned char *)"研究生命";
+  size_t word_size;
+  CHECK(jieba_separate(str, 12, &word_size, &data_base)
+        == JIEBA_SEPARATE_SUCCESS);
+  CHECK(word_size == 9);
+
+  size_t word_sizes[JIEBA_SENTENCE_LENGTH], word_count;
+  CHECK(jieba_separate_sentence(str, 12, word_sizes, &word_count, &data_base)
+        == JIEBA_SEPARATE_SUCCESS);
+  CHECK(word_count == 2);
+#if TEST_WORD_INFO
+  CHECK(word_sizes[0] == 6 && word_sizes[1] == 6);
+#else
+  /* without frequencies the fewest words win, and a longer one on a tie */
+  CHECK(word_sizes[0] == 9 && word_sizes[1] == 3);
+#endif
+
+  /* a word of one character is found, and its frequency counts */
+  struct jieba_word_info info;
+  CHECK(jieba_find_word((const unsigned char *)"生", 3, &data_base, &info)
+        == !JIEBA_DOUBLE_ARRAY_TRIE);
+  CHECK(jieba_separate_sentence(str, 9, word_sizes, &word_count, &data_base)
+        == JIEBA_SEPARATE_SUCCESS);
+#if TEST_WORD_INFO
+  CHECK(info.frequency == 100000);
+  CHECK(word_count == 2 && word_sizes[0] == 6 && word_sizes[1] == 3);
+#else
+  CHECK(word_count == 1 && word_sizes[0] == 9);
+#endif
+
+  free(memory);
+}
+
+/*
+ * A tiny model, where 张 and 李 begin words, 五 ends one, and 的 is alone,
+ * so only 三 and 四 are left to the states around them. 中国 is longer
+ * than a character, which ends a run, and 张三 is then made a word.
+ */
+static void test_hmm_join(void) {
+  const double impossible = -3.14e100;
+  const double start[JIEBA_HMM_STATE_COUNT] = {
+    -0.5, impossible, impossible, -0.9
+  };
+  double transition[JIEBA_HMM_STATE_COUNT][JIEBA_HMM_STATE_COUNT];
+  for (int i = 0; i < JIEBA_HMM_STATE_COUNT; i++)
+    for (int j = 0; j < JIEBA_HMM_STATE_COUNT; j++)
+      transition[i][j] = impossible;
+  transition[JIEBA_HMM_BEGIN][JIEBA_HMM_MIDDLE] = -1.2;
+  transition[JIEBA_HMM_BEGIN][JIEBA_HMM_END] = -0.4;
+  transition[JIEBA_HMM_MIDDLE][JIEBA_HMM_MIDDLE] = -1.2;
+  transition[JIEBA_HMM_MIDDLE][JIEBA_HMM_END] = -0.4;
+  transition[JIEBA_HMM_END][JIEBA_HMM_BEGIN] = -0.7;
+  transition[JIEBA_HMM_END][JIEBA_HMM_SINGLE] = -0.7;
+  transition[JIEBA_HMM_SINGLE][JIEBA_HMM_BEGIN] = -0.7;
+  transition[JIEBA_HMM_SINGLE][JIEBA_HMM_SINGLE] = -0.7;
+
+  static const struct {
+    const char *character;
+    enum jieba_hmm_state state;
+    double log_probability;
+  } emissions[] = {
+    {"张", JIEBA_HMM_BEGIN, -0.1},
+    {"三", JIEBA_HMM_END, -0.7},
+    {"三", JIEBA_HMM_SINGLE, -0.7},
+    {"的", JIEBA_HMM_SINGLE, -0.1},
+    {"李", JIEBA_HMM_BEGIN, -0.1},
+    {"四", JIEBA_HMM_MIDDLE, -0.7},
+    {"四", JIEBA_HMM_END, -0.7},
+    {"五", JIEBA_HMM_END, -0.1},
+  };
+  enum { CHARACTER_COUNT = 6 };
+  struct jieba_hmm hmm;
+  size_t size = jieba_hmm_memory_size(CHARACTER_COUNT);
+  void *memory = malloc(size);
+  CHECK(memory != NULL);
+  CHECK(jieba_init_hmm(
+      &hmm, memory, size, CHARACTER_COUNT, start, transition, NULL
+  ) == JIEBA_INIT_SUCCESS);
+  for (size_t i = 0; i < sizeof(emissions) / sizeof(emissions[0]); i++) {
+    const char *character = emissions[i].character;
+    CHECK(jieba_hmm_set_emission(
+        (const unsigned char *)character, strlen(character),
+        emissions[i].state, emissions[i].log_probability, &hmm
+    ) == JIEBA_ADD_WORD_SUCCESS);
+  }
+
+  struct jieba_data_base data_base;
+  size_t data_base_size = jieba_estimate_memory_size(TEST_ESTIMATED_WORD_COUNT);
+  void *data_base_memory = malloc(data_base_size);
+  CHECK(data_base_memory != NULL);
+  CHECK(jieba_init_data_base(
+      &data_base, data_base_memory, data_base_size,
+      TEST_ESTIMATED_WORD_COUNT, NULL
+  ) == JIEBA_INIT_SUCCESS);
+
+  const unsigned char *str = (const unsigned char *)"张三中国的李四五";
+  const size_t characters[] = {3, 3, 6, 3, 3, 3, 3};
+  size_t word_sizes[7], word_count = 7;
+  memcpy(word_sizes, characters, sizeof(characters));
+  jieba_hmm_join_characters(str, word_sizes, &word_count, &hmm, &data_base);
+  CHECK(word_count == 4);
+  CHECK(word_sizes[0] == 6 && word_sizes[1] == 6);
+  CHECK(word_sizes[2] == 3 && word_sizes[3] == 9);
+
+  /* a run that is a word is left in characters, as jieba does */
+  CHECK(jieba_add_word((unsigned char *)str, 6, &data_base)
+        == JIEBA_ADD_WORD_SUCCESS);
+  word_count = 7;
+  memcpy(word_sizes, characters, sizeof(characters));
+  jieba_hmm_join_characters(str, word_sizes, &word_count, &hmm, &data_base);
+  CHECK(word_count == 5);
+  CHECK(word_sizes[0] == 3 && word_sizes[1] == 3 && word_sizes[2] == 6);
+  CHECK(word_sizes[3] == 3 && word_sizes[4] == 9);
+
+  free(data_base_memory);
+  free(memory);
+}
+
+static void *grow_memory(
+    void *memory, size_t size, size_t new_size, void *context
+) {
+  (void)size; (void)context;
+  return realloc(memory, new_size);
+}
+
+/*
+ * A data base sized for a few words grows through the allocator, every
+ * part of it many times, until it has taken all the words of 1 to 3
+ * characters, and they are all found.
+ */
+static void test_grow(void) {
+  enum { WORD_COUNT = 20000 };
+  struct jieba_data_base data_base;
+  size_t size = jieba_estimate_memory_size(16);
+  void *memory = malloc(size);
+  CHECK(memory != NULL);
+  CHECK(jieba_init_data_base(&data_base, memory, size, 16, NULL)
+        == JIEBA_INIT_SUCCESS);
+  struct jieba_allocator allocator = { grow_memory, NULL, NULL };
+  jieba_set_allocator(&data_base, &allocator);
+
+  unsigned char word[9];
+  for (size_t i = 0; i < WORD_COUNT; i++) {
+    size_t word_size = make_word(i * 7919, word) / 3 * (i % 3 + 1);
+    CHECK(jieba_add_word(word, word_size, &data_base)
+          == JIEBA_ADD_WORD_SUCCESS);
+  }
+  CHECK(data_base.whole_memory_size > size);
+
+  for (size_t i = 0; i < WORD_COUNT; i++) {
+    size_t word_size = make_word(i * 7919, word) / 3 * (i % 3 + 1);
+    CHECK(jieba_find_word(word, word_size, &data_base, NULL)
+          == (word_size > 3 || !JIEBA_DOUBLE_ARRAY_TRIE));
+  }
+
+  free(data_base.whole_memory);
+}
+
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+/*
+ * A word added before the staged ones takes the room counted for one of
+ * them, so a table fails to be built, and its words are still found where
+ * they are staged until it is built after growing.
+ */
+static void test_stage_words(void) {
+  enum { WORD_COUNT = 1000 };
+  static unsigned char word_bytes[WORD_COUNT + 2][9];
+  const unsigned char *words[WORD_COUNT];
+  size_t word_sizes[WORD_COUNT];
+  for (size_t i = 0; i < WORD_COUNT + 2; i++) {
+    size_t word_size = make_word(i * 7919, word_bytes[i]);
+    if (i < WORD_COUNT) {
+      words[i] = word_bytes[i];
+      word_sizes[i] = word_size;
+    }
+  }
+
+  struct jieba_word_counts counts;
+  memset(&counts, 0, sizeof(counts));
+  jieba_count_words(words, word_sizes, WORD_COUNT, &counts);
+  size_t size = jieba_lazy_memory_size(&counts);
+  void *memory = malloc(size);
+  CHECK(memory != NULL);
+  struct jieba_data_base data_base;
+  CHECK(jieba_init_data_base_lazily(&data_base, memory, size, &counts, NULL)
+        == JIEBA_INIT_SUCCESS);
+  CHECK(jieba_add_word(word_bytes[WORD_COUNT], 9, &data_base)
+        == JIEBA_ADD_WORD_SUCCESS);
+  CHECK(jieba_stage_words(words, word_sizes, WORD_COUNT, &data_base, NULL)
+        == JIEBA_ADD_WORD_SUCCESS);
+
+  for (int grown = 0; grown < 2; grown++) {
+    for (size_t i = 0; i < WORD_COUNT; i++) {
+      size_t separated;
+      CHECK(jieba_find_word(words[i], 9, &data_base, NULL));
+      CHECK(jieba_separate(words[i], 9, &separated, &data_base)
+            == JIEBA_SEPARATE_SUCCESS);
+      CHECK(separated == 9);
+    }
+    CHECK(jieba_find_word(word_bytes[WORD_COUNT], 9, &data_base, NULL));
+    CHECK(jieba_find_word(word_bytes[WORD_COUNT + 1], 9, &data_base, NULL)
+          == grown);
+
+    struct jieba_data_base frozen;
+    size_t frozen_size = jieba_freeze_memory_size(&data_base);
+    void *frozen_memory = malloc(frozen_size);
+    CHECK(frozen_memory != NULL);
+    enum jieba_freeze_result res = jieba_freeze_data_base(
+        &data_base, &frozen, frozen_memory, frozen_size, NULL
+    );
+    if (grown) {
+      CHECK(res == JIEBA_FREEZE_SUCCESS);
+      for (size_t i = 0; i < WORD_COUNT; i++)
+        CHECK(jieba_find_word(words[i], 9, &frozen, NULL));
+    }
+    free(frozen_memory);
+
+    /* the failing table is built when adding a word grows the data base */
+    if (!grown) {
+      CHECK(res == JIEBA_FREEZE_FAIL_NOMEM);
+      struct jieba_allocator allocator = { grow_memory, NULL, NULL };
+      jieba_set_allocator(&data_base, &allocator);
+      CHECK(jieba_add_word(word_bytes[WORD_COUNT + 1], 9, &data_base)
+            == JIEBA_ADD_WORD_SUCCESS);
+    }
+  }
+
+  free(data_base.whole_memory);
+}
+#endif
+
 int main() {
   init_jieba_dict();
 
@@ -40,4 +968,25 @@ int main() {
     str += word_size;
     size -= word_size;
   }
+
+  test_save_and_load();
+  test_add_dictionary();
+  test_compact();
+  test_dirty_memory();
+  test_exact_memory_size();
+  test_add_words();
+  test_add_words_parallel();
+  test_character_sizes();
+  test_packed_words();
+  test_longest_word();
+  test_bloom_filter();
+  test_table_doubling();
+  test_length_mask_pages();
+  test_separate_sentence();
+  test_hmm_join();
+  test_grow();
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+  /* the double array trie has nothing to stage */
+  test_stage_words();
+#endif
 }
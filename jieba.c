@@ -6,6 +6,49 @@
 #include "jieba.h"
 #include "wyhash.h"
 
+/* SSE2 is used where the compiler targets it, 0 keeps the plain code */
+#ifndef JIEBA_SSE2
+# if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#  define JIEBA_SSE2 1
+# else
+#  define JIEBA_SSE2 0
+# endif
+#endif
+#if JIEBA_SSE2
+# include <emmintrin.h>
+#endif
+
+/* map saved data bases with mmap, or leave loading from files to users */
+#ifndef JIEBA_MMAP
+# if defined(__unix__) || defined(__APPLE__)
+#  define JIEBA_MMAP 1
+# else
+#  define JIEBA_MMAP 0
+# endif
+#endif
+
+/* build with several threads through pthreads, see jieba_add_words_parallel */
+#ifndef JIEBA_THREADS
+# if (defined(__unix__) || defined(__APPLE__)) &&\
+     (defined(__GNUC__) || defined(__clang__))
+#  define JIEBA_THREADS 1
+# else
+#  define JIEBA_THREADS 0
+# endif
+#endif
+
+#if JIEBA_THREADS
+# include <pthread.h>
+#endif
+
+#if JIEBA_MMAP
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <errno.h>
+#endif
+
 #ifdef JIEBA__DEBUG
 # define jieba__log(fmt, ...)\
   printf("file: %s; func: %s; line: %d; " fmt,  __FILE__, __func__, __LINE__,\
@@ -24,6 +67,16 @@
 # define JIEBA_ASSUME_AVERAGE_WORD_LENGTH 4
 #endif 
 
+/* keep words as utf 8 bytes, and match the input without converting it */
+#ifndef JIEBA_UTF8_KEYS
+# define JIEBA_UTF8_KEYS 1
+#endif
+
+/* utf 8 bytes retained for each estimated character, only for utf 8 keys */
+#ifndef JIEBA_ASSUME_AVERAGE_CHARACTER_SIZE
+# define JIEBA_ASSUME_AVERAGE_CHARACTER_SIZE 3
+#endif
+
 #ifndef JIEBA_ESTIMATED_WORD_COUNT_OFFSET
 # define JIEBA_ESTIMATED_WORD_COUNT_OFFSET 1024
 #endif
@@ -40,37 +93,264 @@
 # define JIEBA_HASH_TABLE_INITIAL_MAX_CELL_PER_BUCKET 8
 #endif
 
+#define JIEBA_HASH_TABLE_CHAINING 0
+#define JIEBA_HASH_TABLE_SWISS 1
+#define JIEBA_HASH_TABLE_CUCKOO 2
+
+/* how words of the same length are kept, when there is no trie */
+#ifndef JIEBA_HASH_TABLE
+# define JIEBA_HASH_TABLE JIEBA_HASH_TABLE_CHAINING
+#endif
+
+/* hash all prefixes of a string in one pass, instead of each on its own */
+#ifndef JIEBA_INCREMENTAL_PREFIX_HASH
+# define JIEBA_INCREMENTAL_PREFIX_HASH 1
+#endif
+
+/* look words up through a double array trie instead of the hash tables */
+#ifndef JIEBA_DOUBLE_ARRAY_TRIE
+# define JIEBA_DOUBLE_ARRAY_TRIE 0
+#endif
+
+#ifndef JIEBA_ESTIMATED_TRIE_UNIT_COUNT_COEFFICIENT
+# define JIEBA_ESTIMATED_TRIE_UNIT_COUNT_COEFFICIENT 1.414
+#endif
+
+#ifndef JIEBA_TRIE_FIND_BASE_TRIALS
+# define JIEBA_TRIE_FIND_BASE_TRIALS 256
+#endif
+
+/* every page holds the word length masks of 256 consecutive code points */
+#ifndef JIEBA_LENGTH_MASK_PAGE_COUNT
+# define JIEBA_LENGTH_MASK_PAGE_COUNT 256
+#endif
+
+/* check a blocked bloom filter of all words before touching the tables */
+#ifndef JIEBA_BLOOM_FILTER
+# define JIEBA_BLOOM_FILTER 1
+#endif
+
+#ifndef JIEBA_BLOOM_FILTER_BITS_PER_WORD
+# define JIEBA_BLOOM_FILTER_BITS_PER_WORD 12
+#endif
+
+/* bits set for a word, all of them in the same 512 bits block */
+#ifndef JIEBA_BLOOM_FILTER_HASH_NUMBER
+# define JIEBA_BLOOM_FILTER_HASH_NUMBER 6
+#endif
+
+#if JIEBA_BLOOM_FILTER_HASH_NUMBER < 1 || JIEBA_BLOOM_FILTER_HASH_NUMBER > 7
+# error "JIEBA_BLOOM_FILTER_HASH_NUMBER should be between 1 and 7"
+#endif
+
+/*
+ * Hash cells and buckets use 32 bits positions, 16 bits string sizes and 32
+ * bits hashes, it halves them, but limits the words to about 4 billions.
+ */
+#ifndef JIEBA_COMPACT_LAYOUT
+# define JIEBA_COMPACT_LAYOUT 1
+#endif
+
+/*
+ * Words of at most this many characters are kept in their hash cells, as 21
+ * bits code points packed in one 64 bits integer for 3 characters, or two for
+ * 6, so matching them is an integer compare. Set it to 0 to disable.
+ */
+#ifndef JIEBA_PACKED_KEY_MAX_LENGTH
+# define JIEBA_PACKED_KEY_MAX_LENGTH 3
+#endif
+
+#if JIEBA_PACKED_KEY_MAX_LENGTH < 0 || JIEBA_PACKED_KEY_MAX_LENGTH > 6
+# error "JIEBA_PACKED_KEY_MAX_LENGTH should be between 0 and 6"
+#endif
+
+/* average keys number of a bucket of a frozen table, each bucket has a pilot */
+#ifndef JIEBA_FREEZE_KEYS_PER_BUCKET
+# define JIEBA_FREEZE_KEYS_PER_BUCKET 4
+#endif
+
+/*
+ * Keep a frequency and a part of speech tag for each word, they are given by
+ * jieba_add_word_with_info and read by jieba_find_word. A trie keeps none.
+ */
+#ifndef JIEBA_WORD_INFO
+# define JIEBA_WORD_INFO 1
+#endif
+
+/* a frozen table of n keys has n + n / JIEBA_FREEZE_SLOT_REDUNDANCY + 1 slots*/
+#ifndef JIEBA_FREEZE_SLOT_REDUNDANCY
+# define JIEBA_FREEZE_SLOT_REDUNDANCY 32
+#endif
+
+/*
+ * Words of one character are kept for their frequencies, a trie keeps no
+ * frequency, so it keeps no such word.
+ */
+#if JIEBA_DOUBLE_ARRAY_TRIE
+# define JIEBA__SHORTEST_WORD 2
+#else
+# define JIEBA__SHORTEST_WORD 1
+#endif
+
+#define JIEBA__LENGTH_MASK_DIRECTORY_COUNT (0x110000 >> 8)
+/* a page that could not be allocated admits every word length */
+#define JIEBA__LENGTH_MASK_PAGE_FULL ((uint32_t)-1)
+
+#if JIEBA_MAX_WORD_LENGTH <= 32
+typedef uint32_t jieba__length_mask;
+#elif JIEBA_MAX_WORD_LENGTH <= 64
+typedef uint64_t jieba__length_mask;
+#else
+# error "JIEBA_MAX_WORD_LENGTH should not be greater than 64"
+#endif
+
 struct jieba__utf32be {
   uint8_t data[4];
 };
 
+/* what the words in the hash tables are made of */
+#if JIEBA_UTF8_KEYS
+typedef uint8_t jieba__key_unit;
+#else
+typedef struct jieba__utf32be jieba__key_unit;
+#endif
+
+/*
+ * The trie walks utf 8 bytes, the code of a byte is its value plus 1. A child
+ * of state s through code c lives at base(s) + c modulo 2^31, and is owned by
+ * s only if its check is s. A check of 0 marks a free unit.
+ */
+struct jieba__trie_unit {
+  uint32_t base; /* the highest bit tells whether the state ends a word */
+  uint32_t check;
+};
+
+/* a block is a cache line, a lookup of the filter only touches one block */
+struct jieba__bloom_filter_block {
+  uint64_t bits[8];
+};
+
+/*
+ * A frozen table maps a word to its slot by a perfect hash. The hash picks a
+ * bucket, and the pilot of the bucket, found while freezing, moves every word
+ * of the bucket to a slot no other word takes. The parts of a frozen data
+ * base are offsets to its root, so that it could be moved as a whole.
+ */
+struct jieba__frozen_table {
+  uint64_t seed;
+  size_t slot_count;
+  size_t bucket_count;
+  size_t pilots; /* uint16_t[bucket_count] */
+  size_t slots; /* struct jieba__frozen_slot[slot_count] */
+  size_t infos; /* struct jieba__word_info[slot_count], if JIEBA_WORD_INFO */
+};
+
+struct jieba__frozen_slot {
+  uint32_t key_pos;
+  uint16_t fingerprint;
+  uint16_t key_size; /* 0 for an empty slot, a utf 8 key may be 256 bytes */
+};
+
+struct jieba__word_info {
+  uint32_t frequency;
+  uint8_t tag[4];
+  int16_t log_frequency; /* log2 of the frequency in 1/256 */
+};
+
+/* only used while building, a free unit links its free neighbours instead */
+struct jieba__trie_link {
+  uint32_t child; /* code of the first child */
+  uint32_t sibling; /* code of the next sibling */
+};
+
+/* bit n - 1 is set if some word of n characters starts with the code point */
+struct jieba__length_mask_page {
+  jieba__length_mask masks[256];
+#if JIEBA_WORD_INFO
+  int16_t log_frequencies[256]; /* of the words of one character */
+#endif
+};
+
+#if JIEBA_COMPACT_LAYOUT
+typedef uint32_t jieba__pos;
+typedef uint32_t jieba__cell_hash;
+typedef uint16_t jieba__string_size;
+#else
+typedef size_t jieba__pos;
+typedef uint64_t jieba__cell_hash;
+typedef size_t jieba__string_size;
+#endif
+
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+/* a narrow position of -1 is widened to (size_t)-1 */
+static size_t jieba__pos_of(jieba__pos pos) {
+  return pos == (jieba__pos)-1 ? (size_t)-1 : pos;
+}
+#endif
+
 struct jieba__string {
-  size_t count;
-  size_t first_character_pos;
+  jieba__pos first_character_pos;
+  jieba__string_size count;
 };
 
+#define JIEBA__PACKED_KEY_BITS 21
+#define JIEBA__PACKED_KEY_PER_INTEGER 3
+#define JIEBA__PACKED_KEY_INTEGERS (JIEBA_PACKED_KEY_MAX_LENGTH > 3 ? 2 : 1)
+
 struct jieba__hash_table_cell {
-  size_t next_cell_pos;
-  uint64_t hash;
-  struct jieba__string string;
+  jieba__pos next_cell_pos;
+  jieba__cell_hash hash;
+  /* the characters number of the table tells which one is used */
+  union {
+    struct jieba__string string;
+    uint64_t packed[JIEBA__PACKED_KEY_INTEGERS];
+  } key;
 };
 
 struct jieba__hash_table_bucket {
-  size_t count;
-  size_t first_cell_pos;
+  jieba__pos count;
+  jieba__pos first_cell_pos;
 };
 
 struct jieba__hash_table_node {
-  size_t next_node_pos;
-  size_t unused_for_alignment;
+  size_t next_run_pos; /* next free run, only for first node of a free run */
+  size_t free_count; /* nodes number of a free run, as above */
   struct jieba__hash_table_bucket buckets[JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER];
 };
 
+/*
+ * A swiss table lays its nodes out as groups of 16 control bytes, followed by
+ * the cell positions of all slots. A control byte is either empty, or the
+ * lowest 7 bits of the hash of the cell in its slot.
+ */
+#define JIEBA__SWISS_GROUP_WIDTH 16
+#define JIEBA__SWISS_EMPTY ((uint8_t)0x80)
+
+/*
+ * A cuckoo table lays its nodes out as buckets of 8 slots. A word is in one
+ * of the two buckets its hash points to, or in a stash of a few linked cells,
+ * so a lookup reads at most two buckets and the stash. A tag is the lowest 8
+ * bits of the hash of the cell in its slot, or 0 for an empty slot.
+ */
+#define JIEBA__CUCKOO_SLOTS 8
+#define JIEBA__CUCKOO_MAX_KICKS 256
+#define JIEBA__CUCKOO_MAX_STASH 4
+
+struct jieba__cuckoo_bucket {
+  uint8_t tags[JIEBA__CUCKOO_SLOTS];
+  jieba__pos cells[JIEBA__CUCKOO_SLOTS];
+};
+
 struct jieba__hash_table {
   size_t count;
-  size_t size; /* buckets number */
+  size_t size; /* buckets number, or groups number of a swiss table */
   size_t max_cell_per_bucket;
   size_t first_node_pos;
+  size_t node_count;
+#if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CUCKOO
+  size_t stash_count;
+  size_t first_stash_cell_pos;
+#endif
 };
 
 struct jieba__data_base_node {
@@ -79,16 +359,59 @@ struct jieba__data_base_node {
   struct jieba__hash_table table;
 };
 
+/*
+ * How many of each thing a data base retains, estimated from a words number,
+ * or counted from the words it is going to have.
+ */
+struct jieba__space_counts {
+  size_t characters; /* key units of the words that are not packed */
+  size_t cells;
+  size_t hash_table_nodes;
+  size_t length_mask_pages;
+  size_t bloom_filter_blocks;
+  size_t trie_units;
+  size_t staged_bytes; /* words put aside, see jieba_stage_words */
+};
+
+/* a word takes up to 4 bytes a character, which 1 byte may not number */
+#if JIEBA_MAX_WORD_LENGTH * 4 > 255
+# define JIEBA__STAGED_SIZE_BYTES 2
+#else
+# define JIEBA__STAGED_SIZE_BYTES 1
+#endif
+
+/* a word found among the staged ones has no position in a table */
+#define JIEBA__STAGED_POS ((size_t)-2)
+
+/*
+ * The words of one length put aside until the table of the length is first
+ * used, each as its bytes number, least significant byte first, and its
+ * bytes.
+ */
+struct jieba__staged_words {
+  size_t at; /* of the first word in the staging space */
+  size_t size, room; /* bytes staged and retained */
+  size_t count, limit; /* words staged and counted, count is 0 once built */
+  size_t put; /* bytes of the words already put in the table */
+  size_t failed; /* the memory ran out building them, until it grows */
+};
+
 struct jieba__data_base {
   size_t estimated_word_count;
+  struct jieba__space_counts space_counts;
 
   size_t character_space_size;
   size_t character_space_used;
-  struct jieba__utf32be *characterp; /* for bump */
+  jieba__key_unit *characterp; /* for bump */
+  size_t packed_key_units; /* key units of the packed words, for freezing */
 
   size_t hash_table_cell_space_size;
-  size_t hash_table_cell_first_free;
+  size_t hash_table_cell_first_free; /* only cells freed after used */
+  size_t hash_table_cell_frontier; /* cells from here on were never used */
   struct jieba__hash_table_cell *hash_table_cells;
+#if JIEBA_WORD_INFO
+  struct jieba__word_info *word_infos; /* of the cells at the same positions */
+#endif
 
   size_t hash_table_node_space_size;
   size_t hash_table_node_first_free;
@@ -99,6 +422,44 @@ struct jieba__data_base {
   struct jieba__data_base_node *data_base_nodes;
 
   size_t first_data_base_node_pos;
+  size_t length_data_base_node_pos[JIEBA_MAX_WORD_LENGTH + 1];
+  uint64_t frequency_total; /* of all words, for jieba_separate_sentence */
+
+  size_t length_mask_space_size;
+  size_t length_mask_page_used;
+  uint32_t *length_mask_directory;
+  struct jieba__length_mask_page *length_mask_pages;
+
+  /* a frozen data base is read only, see jieba_freeze_data_base */
+  size_t frozen;
+  size_t frozen_size;
+  size_t frozen_trie_units;
+  size_t frozen_length_mask_directory;
+  size_t frozen_length_mask_pages;
+  size_t frozen_keys;
+  struct jieba__frozen_table frozen_tables[JIEBA_MAX_WORD_LENGTH + 1];
+
+#if JIEBA_BLOOM_FILTER
+  size_t bloom_filter_space_size;
+  size_t bloom_filter_block_count;
+  struct jieba__bloom_filter_block *bloom_filter_blocks;
+#endif
+
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+  size_t staging_space_size;
+  unsigned char *staging;
+  size_t staged_lengths; /* lengths with words still staged */
+  struct jieba__staged_words staged_words[JIEBA_MAX_WORD_LENGTH + 1];
+#endif
+
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  size_t trie_space_size;
+  size_t trie_unit_count;
+  size_t trie_unit_first_free;
+  size_t trie_unit_frontier; /* units from here on were never used */
+  struct jieba__trie_unit *trie_units;
+  struct jieba__trie_link *trie_links;
+#endif
 };
 
 static size_t jieba__character_space_count(size_t estimated_word_count) {
@@ -108,20 +469,22 @@ static size_t jieba__character_space_count(size_t estimated_word_count) {
   return count;
 }
 
-static size_t jieba__character_space_size(size_t estimated_word_count) {
-  size_t count, size;
-  size = sizeof(struct jieba__utf32be);
-  count = jieba__character_space_count(estimated_word_count);
-  return size * count;
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+/* rounded up to keep the cells after the characters aligned */
+static size_t jieba__character_space_size(
+    const struct jieba__space_counts *counts
+) {
+  return (sizeof(jieba__key_unit) * counts->characters + 7) & ~(size_t)7;
 }
 
 static size_t jieba__init_character_space(
-    size_t estimated_word_count, void *restrict whole_memory,
+    const struct jieba__space_counts *counts, void *restrict whole_memory,
     size_t whole_memory_used, struct jieba__data_base *root
 ) {
-  size_t size = jieba__character_space_size(estimated_word_count);
+  size_t size = jieba__character_space_size(counts);
   root->character_space_size = size;
   root->character_space_used = 0;
+  root->packed_key_units = 0;
   root->characterp = whole_memory + whole_memory_used;
   jieba__log("retain %zu bytes for characters\n", size);
   return size;
@@ -134,35 +497,46 @@ static size_t jieba__hash_table_cell_space_count(size_t estimated_word_count) {
   return count;
 }
 
-static size_t jieba__hash_table_cell_space_size(size_t estimated_word_count) {
-  size_t count, size;
+/* rounded up to keep the nodes after the infos aligned */
+static size_t jieba__hash_table_cell_space_size(
+    const struct jieba__space_counts *counts
+) {
+  size_t size;
   size = sizeof(struct jieba__hash_table_cell);
-  count = jieba__hash_table_cell_space_count(estimated_word_count);
-  return count * size;
+#if JIEBA_WORD_INFO
+  size += sizeof(struct jieba__word_info);
+#endif
+  return (counts->cells * size + 7) & ~(size_t)7;
 }
 
 static size_t jieba__init_hash_table_cell_space(
-    size_t estimated_word_count, void *restrict whole_memory,
+    const struct jieba__space_counts *counts, void *restrict whole_memory,
     size_t whole_memory_used, struct jieba__data_base *root
 ) {
-  size_t size = jieba__hash_table_cell_space_size(estimated_word_count);
+  size_t size = jieba__hash_table_cell_space_size(counts);
   root->hash_table_cell_space_size = size;
   root->hash_table_cell_first_free = 0;
   root->hash_table_cells = whole_memory + whole_memory_used;
+#if JIEBA_WORD_INFO
+  root->word_infos = (struct jieba__word_info *)&root->hash_table_cells[
+    counts->cells
+  ];
+#endif
   jieba__log(
-      "retain %zu bytes for %zu hash table cells\n", size,
-      jieba__hash_table_cell_space_count(estimated_word_count)
+      "retain %zu bytes for %zu hash table cells\n", size, counts->cells
   );
   return size;
 }
 
+/*
+ * Cells are bumped from the frontier, so the pages of the cells are only
+ * touched once they are used, the free list only has the cells freed.
+ */
 static void jieba__init_hash_table_cell_free_list(
-    size_t estimated_word_count, struct jieba__data_base *root
+    struct jieba__data_base *root
 ) {
-  size_t count = jieba__hash_table_cell_space_count(estimated_word_count);
-  for (size_t i = 0; i < count; i++)
-    root->hash_table_cells[i].next_cell_pos = i + 1;
-  root->hash_table_cells[count - 1].next_cell_pos = (size_t)-1;
+  root->hash_table_cell_first_free = (size_t)-1;
+  root->hash_table_cell_frontier = 0;
 }
 
 static size_t jieba__hash_table_node_space_count(size_t estimated_word_count) {
@@ -177,35 +551,41 @@ static size_t jieba__hash_table_node_space_count(size_t estimated_word_count) {
   return count;
 }
 
-static size_t jieba__hash_table_node_space_size(size_t estimated_word_count) {
-  size_t count, size;
-  size = sizeof(struct jieba__hash_table_node);
-  count = jieba__hash_table_node_space_count(estimated_word_count);
-  return size * count;
+static size_t jieba__hash_table_node_space_size(
+    const struct jieba__space_counts *counts
+) {
+  return sizeof(struct jieba__hash_table_node) * counts->hash_table_nodes;
 }
 
 static size_t jieba__init_hash_table_node_space(
-    size_t estimated_word_count, void *restrict whole_memory,
+    const struct jieba__space_counts *counts, void *restrict whole_memory,
     size_t whole_memory_used, struct jieba__data_base *root
 ) {
-  size_t size = jieba__hash_table_node_space_size(estimated_word_count);
+  size_t size = jieba__hash_table_node_space_size(counts);
   root->hash_table_node_space_size = size;
   root->hash_table_node_first_free = 0;
   root->hash_table_nodes = whole_memory + whole_memory_used;
   jieba__log(
       "retain %zu bytes for %zu hash table nodes\n", size,
-      jieba__hash_table_node_space_count(estimated_word_count)
+      counts->hash_table_nodes
   );
   return size;
 }
 
+/*
+ * Free hash table nodes are kept as runs of consecutive nodes sorted by their
+ * positions, so that a hash table could always have consecutive nodes.
+ */
 static void jieba__init_hash_table_node_free_list(
-    size_t estimated_word_count, struct jieba__data_base *root
+    struct jieba__data_base *root
 ) {
-  size_t count = jieba__hash_table_node_space_count(estimated_word_count);
-  for (size_t i = 0; i < count; i++)
-    root->hash_table_nodes[i].next_node_pos = i + 1;
-  root->hash_table_nodes[count - 1].next_node_pos = (size_t)-1;
+  size_t count = root->space_counts.hash_table_nodes;
+  if (count == 0) {
+    root->hash_table_node_first_free = (size_t)-1;
+    return;
+  }
+  root->hash_table_nodes[0].next_run_pos = (size_t)-1;
+  root->hash_table_nodes[0].free_count = count;
 }
 
 static size_t jieba__data_base_node_space_count() {
@@ -243,18 +623,197 @@ static void jieba__init_data_base_node_free_list(
   root->data_base_nodes[count - 1].next_node_pos = (size_t)-1;
 }
 
-size_t jieba_estimate_memory_size(size_t estimated_word_count) {
+static size_t jieba__length_mask_space_size(
+    const struct jieba__space_counts *counts
+) {
+  return sizeof(uint32_t) * JIEBA__LENGTH_MASK_DIRECTORY_COUNT
+    + sizeof(struct jieba__length_mask_page) * counts->length_mask_pages;
+}
+
+static size_t jieba__init_length_mask_space(
+    const struct jieba__space_counts *counts, void *restrict whole_memory,
+    size_t whole_memory_used, struct jieba__data_base *root
+) {
+  size_t size = jieba__length_mask_space_size(counts);
+  root->length_mask_space_size = size;
+  root->length_mask_page_used = 0;
+  root->length_mask_directory = whole_memory + whole_memory_used;
+  root->length_mask_pages = (void *)
+    (root->length_mask_directory + JIEBA__LENGTH_MASK_DIRECTORY_COUNT);
+  jieba__log(
+      "retain %zu bytes for %zu length mask pages\n", size,
+      counts->length_mask_pages
+  );
+  return size;
+}
+
+static void jieba__init_length_masks(struct jieba__data_base *root) {
+  for (size_t i = 0; i < JIEBA__LENGTH_MASK_DIRECTORY_COUNT; i++)
+    root->length_mask_directory[i] = 0;
+  for (size_t i = 0; i <= JIEBA_MAX_WORD_LENGTH; i++)
+    root->length_data_base_node_pos[i] = (size_t)-1;
+}
+
+#if JIEBA_BLOOM_FILTER
+static size_t jieba__bloom_filter_block_count(size_t estimated_word_count) {
+  size_t count;
+  count = estimated_word_count + JIEBA_ESTIMATED_WORD_COUNT_OFFSET;
+  count *= JIEBA_BLOOM_FILTER_BITS_PER_WORD;
+  return (count + 511) / 512;
+}
+
+static size_t jieba__bloom_filter_space_size(
+    const struct jieba__space_counts *counts
+) {
+  size_t size = sizeof(struct jieba__bloom_filter_block);
+  /* plus the padding to align the blocks with cache lines */
+  return size * counts->bloom_filter_blocks + size - 1;
+}
+
+static size_t jieba__init_bloom_filter_space(
+    const struct jieba__space_counts *counts, void *restrict whole_memory,
+    size_t whole_memory_used, struct jieba__data_base *root
+) {
+  size_t size = jieba__bloom_filter_space_size(counts);
+  uintptr_t blocks = (uintptr_t)whole_memory + whole_memory_used;
+  blocks += (size_t)-blocks % sizeof(struct jieba__bloom_filter_block);
+  root->bloom_filter_space_size = size;
+  root->bloom_filter_block_count = counts->bloom_filter_blocks;
+  root->bloom_filter_blocks = (struct jieba__bloom_filter_block *)blocks;
+  jieba__log(
+      "retain %zu bytes for %zu bloom filter blocks\n", size,
+      root->bloom_filter_block_count
+  );
+  return size;
+}
+
+static void jieba__init_bloom_filter(struct jieba__data_base *root) {
+  memset(
+      root->bloom_filter_blocks, 0,
+      sizeof(struct jieba__bloom_filter_block) *
+        root->bloom_filter_block_count
+  );
+}
+#endif
+
+/* the staging space is the last part, so it is dropped once all are built */
+static size_t jieba__init_staging_space(
+    const struct jieba__space_counts *counts, void *restrict whole_memory,
+    size_t whole_memory_used, struct jieba__data_base *root
+) {
+  root->staging_space_size = counts->staged_bytes;
+  root->staging = (unsigned char *)whole_memory + whole_memory_used;
+  root->staged_lengths = 0;
+  memset(root->staged_words, 0, sizeof(root->staged_words));
+  jieba__log("retain %zu bytes for staged words\n", counts->staged_bytes);
+  return counts->staged_bytes;
+}
+#endif
+
+#if JIEBA_DOUBLE_ARRAY_TRIE
+static size_t jieba__trie_unit_space_count(size_t estimated_word_count) {
+  size_t count;
+  count = jieba__character_space_count(estimated_word_count);
+  count *= JIEBA_ESTIMATED_TRIE_UNIT_COUNT_COEFFICIENT;
+  /* the children of a state may spread as wide as the alphabet */
+  count += 257;
+  return count;
+}
+
+static size_t jieba__trie_space_size(const struct jieba__space_counts *counts) {
+  size_t size;
+  size = sizeof(struct jieba__trie_unit) + sizeof(struct jieba__trie_link);
+  return counts->trie_units * size;
+}
+
+static size_t jieba__init_trie_space(
+    const struct jieba__space_counts *counts, void *restrict whole_memory,
+    size_t whole_memory_used, struct jieba__data_base *root
+) {
+  size_t size = jieba__trie_space_size(counts);
+  size_t count = counts->trie_units;
+  root->trie_space_size = size;
+  root->trie_unit_count = count;
+  root->trie_units = whole_memory + whole_memory_used;
+  root->trie_links = (void *)(root->trie_units + count);
+  jieba__log("retain %zu bytes for %zu trie units\n", size, count);
+  return size;
+}
+
+#define JIEBA__TRIE_ROOT 1
+#define JIEBA__TRIE_TERMINAL ((uint32_t)1 << 31)
+#define JIEBA__TRIE_BASE_MASK (JIEBA__TRIE_TERMINAL - 1)
+/* bases wrap around, the terminal flag is dropped by the mask as well */
+#define JIEBA__TRIE_POS(base, code)\
+  (((size_t)(base) + (code)) & JIEBA__TRIE_BASE_MASK)
+
+/*
+ * Units below the frontier that are free are chained in a doubly linked list
+ * through their links, the ones above it are all free, and are not even
+ * cleared until the frontier passes them, so a unit above it reads as free.
+ */
+static void jieba__init_trie(struct jieba__data_base *root) {
+  /* unit 0 is never used, and the root has no parent, keep them occupied */
+  root->trie_units[0].base = root->trie_units[JIEBA__TRIE_ROOT].base = 0;
+  root->trie_units[0].check = (uint32_t)-1;
+  root->trie_units[JIEBA__TRIE_ROOT].check = (uint32_t)-1;
+  root->trie_links[JIEBA__TRIE_ROOT].child = 0;
+  root->trie_links[JIEBA__TRIE_ROOT].sibling = 0;
+  root->trie_unit_first_free = 0;
+  root->trie_unit_frontier = JIEBA__TRIE_ROOT + 1;
+}
+#endif
+
+static void jieba__estimate_space_counts(
+    size_t estimated_word_count, struct jieba__space_counts *counts
+) {
+  memset(counts, 0, sizeof(*counts));
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  counts->trie_units = jieba__trie_unit_space_count(estimated_word_count);
+#else
+  counts->characters = jieba__character_space_count(estimated_word_count);
+#if JIEBA_UTF8_KEYS
+  counts->characters *= JIEBA_ASSUME_AVERAGE_CHARACTER_SIZE;
+#endif
+  counts->cells = jieba__hash_table_cell_space_count(estimated_word_count);
+  counts->hash_table_nodes =
+    jieba__hash_table_node_space_count(estimated_word_count);
+  counts->length_mask_pages = JIEBA_LENGTH_MASK_PAGE_COUNT;
+#if JIEBA_BLOOM_FILTER
+  counts->bloom_filter_blocks =
+    jieba__bloom_filter_block_count(estimated_word_count);
+#endif
+#endif
+}
+
+static size_t jieba__space_size(const struct jieba__space_counts *counts) {
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  return sizeof(struct jieba__data_base) + jieba__trie_space_size(counts);
+#else
   return sizeof(struct jieba__data_base)
-    + jieba__character_space_size(estimated_word_count)
-    + jieba__hash_table_cell_space_size(estimated_word_count)
-    + jieba__hash_table_node_space_size(estimated_word_count)
-    + jieba__data_base_node_space_size();
+    + jieba__character_space_size(counts)
+    + jieba__hash_table_cell_space_size(counts)
+    + jieba__hash_table_node_space_size(counts)
+    + jieba__data_base_node_space_size()
+    + jieba__length_mask_space_size(counts)
+#if JIEBA_BLOOM_FILTER
+    + jieba__bloom_filter_space_size(counts)
+#endif
+    + counts->staged_bytes;
+#endif
 }
 
-enum jieba_init_result
-jieba_init_data_base(
+size_t jieba_estimate_memory_size(size_t estimated_word_count) {
+  struct jieba__space_counts counts;
+  jieba__estimate_space_counts(estimated_word_count, &counts);
+  return jieba__space_size(&counts);
+}
+
+static enum jieba_init_result
+jieba__init_data_base(
     struct jieba_data_base *restrict data_base, void *restrict whole_memory,
-    size_t whole_memory_size, size_t estimated_word_count, size_t *required
+    size_t whole_memory_size, size_t estimated_word_count,
+    const struct jieba__space_counts *counts, size_t *required
 ) {
   size_t whole_memory_used;
   struct jieba__data_base *root;
@@ -265,43 +824,98 @@ jieba_init_data_base(
 
   data_base->whole_memory = whole_memory;
   data_base->whole_memory_size = whole_memory_size;
+  memset(&data_base->allocator, 0, sizeof(data_base->allocator));
+  data_base->mapped = 0;
 
   root = data_base->root = whole_memory;
   whole_memory_used += sizeof(struct jieba__data_base);
 
+  if (required != NULL) *required = jieba__space_size(counts);
+  if (jieba__space_size(counts) > whole_memory_size)
+    return JIEBA_INIT_FAIL_NOMEM;
+
   root->estimated_word_count = estimated_word_count;
+  root->space_counts = *counts;
+  root->frozen = 0;
 
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  whole_memory_used += jieba__init_trie_space(
+      counts, whole_memory, whole_memory_used, root
+  );
+#else
   whole_memory_used += jieba__init_character_space(
-      estimated_word_count, whole_memory, whole_memory_used, root
+      counts, whole_memory, whole_memory_used, root
   );
 
   whole_memory_used += jieba__init_hash_table_cell_space(
-      estimated_word_count, whole_memory, whole_memory_used, root
+      counts, whole_memory, whole_memory_used, root
   );
 
   whole_memory_used += jieba__init_hash_table_node_space(
-      estimated_word_count, whole_memory, whole_memory_used, root
+      counts, whole_memory, whole_memory_used, root
   );
 
   whole_memory_used += jieba__init_data_base_node_space(
       whole_memory, whole_memory_used, root
   );
 
-  if (required != NULL) *required = whole_memory_used;
-  if (whole_memory_used > whole_memory_size) return JIEBA_INIT_FAIL_NOMEM;
+  whole_memory_used += jieba__init_length_mask_space(
+      counts, whole_memory, whole_memory_used, root
+  );
+
+#if JIEBA_BLOOM_FILTER
+  whole_memory_used += jieba__init_bloom_filter_space(
+      counts, whole_memory, whole_memory_used, root
+  );
+#endif
+
+  whole_memory_used += jieba__init_staging_space(
+      counts, whole_memory, whole_memory_used, root
+  );
+#endif
+  jieba__assert(whole_memory_used == jieba__space_size(counts));
+
+#if JIEBA_COMPACT_LAYOUT && !JIEBA_DOUBLE_ARRAY_TRIE
+  /* -1 is kept for no position */
+  if (counts->cells >= UINT32_MAX || counts->characters >= UINT32_MAX)
+    return JIEBA_INIT_FAIL_TOO_MANY_WORDS;
+#endif
 
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  jieba__init_trie(root);
+#else
   /* initialize free lists */
 
-  jieba__init_hash_table_cell_free_list(estimated_word_count, root);
-  jieba__init_hash_table_node_free_list(estimated_word_count, root);
+  jieba__init_hash_table_cell_free_list(root);
+  jieba__init_hash_table_node_free_list(root);
   jieba__init_data_base_node_free_list(root);
 
+  jieba__init_length_masks(root);
+#if JIEBA_BLOOM_FILTER
+  jieba__init_bloom_filter(root);
+#endif
+#endif
+
   /* initialize data base list */
   root->first_data_base_node_pos = (size_t)-1;
+  root->frequency_total = 0;
 
   return JIEBA_INIT_SUCCESS;
 }
 
+enum jieba_init_result
+jieba_init_data_base(
+    struct jieba_data_base *restrict data_base, void *restrict whole_memory,
+    size_t whole_memory_size, size_t estimated_word_count, size_t *required
+) {
+  struct jieba__space_counts counts;
+  jieba__estimate_space_counts(estimated_word_count, &counts);
+  return jieba__init_data_base(
+      data_base, whole_memory, whole_memory_size, estimated_word_count,
+      &counts, required
+  );
+}
+
 enum jieba__mbtoc32be_result {
   JIEBA__MBTOC32BE_SUCCESS,
   JIEBA__MBTOC32BE_NO_ENOUGH_CHARACTER,
@@ -373,6 +987,15 @@ jieba__mbtoc32be(
   return JIEBA__MBTOC32BE_BAD_UTF8;
 }
 
+static uint32_t jieba__code_point_of_u32be(const struct jieba__utf32be ch) {
+  const uint8_t *in = &ch.data[0];
+  return
+    ((uint32_t)in[0] << 24) |
+    ((uint32_t)in[1] << 16) |
+    ((uint32_t)in[2] << 8)  |
+    ((uint32_t)in[3]);
+}
+
 static enum jieba__mbtoc32be_result
 jieba__mbtoc32bestr(
     const unsigned char *in, size_t in_len, struct jieba__utf32be *outstr,
@@ -391,11 +1014,17 @@ jieba__mbtoc32bestr(
   return JIEBA__MBTOC32BE_SUCCESS;
 }
 
+#if !JIEBA_DOUBLE_ARRAY_TRIE
 static void jieba__init_hash_table(struct jieba__hash_table *table) {
   size_t estimated_word_count;
   table->count = table->size = 0;
   table->max_cell_per_bucket = JIEBA_HASH_TABLE_INITIAL_MAX_CELL_PER_BUCKET;
   table->first_node_pos = -1;
+  table->node_count = 0;
+#if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CUCKOO
+  table->stash_count = 0;
+  table->first_stash_cell_pos = -1;
+#endif
 }
 
 static size_t jieba__allocate_data_base_node2(
@@ -465,6 +1094,7 @@ jieba__find_data_base_node3(
 
     nodes[new_pos].next_node_pos = *first_data_base_node_pos;
     *first_data_base_node_pos = new_pos;
+    data_base->length_data_base_node_pos[word_size] = new_pos;
 
     *data_base_node_pos = new_pos;
     return JIEBA_ADD_WORD_SUCCESS;
@@ -497,6 +1127,7 @@ jieba__find_data_base_node3(
 
     nodes[new_pos].next_node_pos = pos;
     nodes[last_pos].next_node_pos = new_pos;
+    data_base->length_data_base_node_pos[word_size] = new_pos;
 
     jieba__log(
         "link data base node %zu at the end of data base node %zu\n", new_pos,
@@ -566,60 +1197,96 @@ jieba__find_data_base_node(
       data_base, data_base_node_pos
   );
 }
+#endif
 
-static uint64_t jieba__hash(void *str, size_t size) {
+static uint64_t jieba__hash(const void *str, size_t size) {
   return wyhash(str, size, 0, _wyp);
 }
 
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+#if JIEBA_INCREMENTAL_PREFIX_HASH
+/*
+ * The hash of a string is folded character by character, so the hash of a
+ * prefix is a middle state of the hash of the whole string.
+ */
+static uint64_t jieba__hash_step(uint64_t hash, struct jieba__utf32be ch) {
+  uint32_t c;
+  memcpy(&c, ch.data, sizeof(c));
+  return _wymix(hash ^ c ^ _wyp[0], _wyp[1]);
+}
+
+static uint64_t jieba__hash_u32bearr(struct jieba__utf32be *arr, size_t n) {
+  uint64_t hash = 0;
+  for (size_t i = 0; i < n; i++) hash = jieba__hash_step(hash, arr[i]);
+  return hash;
+}
+
+#if !JIEBA_UTF8_KEYS
+/* hashes[i] is the hash of the first i + 1 characters */
+static void jieba__hash_u32bearr_prefixes(
+    struct jieba__utf32be *arr, size_t n, uint64_t *hashes
+) {
+  uint64_t hash = 0;
+  for (size_t i = 0; i < n; i++) {
+    hash = jieba__hash_step(hash, arr[i]);
+    hashes[i] = hash;
+  }
+}
+#endif
+#elif !JIEBA_UTF8_KEYS
+/* utf-8 keys are hashed as they are, only utf-32 ones come here */
 static uint64_t jieba__hash_u32bearr(struct jieba__utf32be *arr, size_t n) {
   return jieba__hash(arr, sizeof(struct jieba__utf32be) * n);
 }
+#endif
+
+/* the hash of a stored key, the same one jieba_separate gets for it */
+static uint64_t jieba__hash_key(const jieba__key_unit *key, size_t key_size) {
+#if JIEBA_UTF8_KEYS && JIEBA_INCREMENTAL_PREFIX_HASH
+  uint64_t hash = 0;
+  size_t cvt_len;
+  for (size_t used = 0; used < key_size; used += cvt_len) {
+    struct jieba__utf32be ch;
+    jieba__mbtoc32be(&key[used], key_size - used, &ch, &cvt_len);
+    hash = jieba__hash_step(hash, ch);
+  }
+  return hash;
+#elif JIEBA_UTF8_KEYS
+  return jieba__hash(key, key_size);
+#else
+  return jieba__hash_u32bearr((struct jieba__utf32be *)key, key_size);
+#endif
+}
 
+/* takes N consecutive nodes from the first run long enough */
 static size_t
 jieba__allocate_hash_table_nodes2(
     size_t N, struct jieba__data_base *data_base,
     size_t *hash_table_node_first_free, struct jieba__hash_table_node *nodes
 ) {
   if (N == 0) return (size_t)-1;
-  if (*hash_table_node_first_free == -1) return (size_t)-1;
 
-  size_t new_pos = *hash_table_node_first_free;
-  size_t last_pos = new_pos;
-  size_t new_free_pos = nodes[new_pos].next_node_pos;
-
-  jieba__assert(
-      new_free_pos == (size_t)-1 || (
-        0 <= new_free_pos &&
-        new_free_pos <=
-          jieba__hash_table_node_space_count(data_base->estimated_word_count)
-      )
-  );
-
-  for (size_t i = 1; i < N; i++) {
-    if (new_free_pos == (size_t)-1) return -1;
-    last_pos = new_free_pos;
-    new_free_pos = nodes[new_free_pos].next_node_pos;
+  size_t last_run = (size_t)-1;
+  size_t run = *hash_table_node_first_free;
+  while (run != (size_t)-1 && nodes[run].free_count < N) {
     jieba__assert(
-        new_free_pos == (size_t)-1 || (
-          0 <= new_free_pos &&
-          new_free_pos <=
-            jieba__hash_table_node_space_count(data_base->estimated_word_count)
-        )
+        run <=
+          data_base->space_counts.hash_table_nodes
     );
+    last_run = run;
+    run = nodes[run].next_run_pos;
   }
+  if (run == (size_t)-1) return (size_t)-1;
 
-  *hash_table_node_first_free = new_free_pos;
-  nodes[last_pos].next_node_pos = (size_t)-1;
-
-  size_t pos = new_pos;
-  for (size_t i = 0; i < N; i++) {
-    for (size_t j = 0; j < JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER; j++) {
-      nodes[pos].buckets[j].count = 0;
-      nodes[pos].buckets[j].first_cell_pos = (size_t)-1;
-    }
-    pos = nodes[pos].next_node_pos;
+  size_t next_run = nodes[run].next_run_pos;
+  if (nodes[run].free_count > N) {
+    nodes[run + N].next_run_pos = next_run;
+    nodes[run + N].free_count = nodes[run].free_count - N;
+    next_run = run + N;
   }
-  return new_pos;
+  if (last_run == (size_t)-1) *hash_table_node_first_free = next_run;
+  else nodes[last_run].next_run_pos = next_run;
+  return run;
 }
 
 static size_t
@@ -628,7 +1295,7 @@ jieba__allocate_hash_table_nodes(size_t N, struct jieba__data_base *data_base) {
       data_base->hash_table_node_first_free == (size_t) -1 || (
         0 <= data_base->hash_table_node_first_free &&
         data_base->hash_table_node_first_free <=
-          jieba__hash_table_node_space_count(data_base->estimated_word_count)
+          data_base->space_counts.hash_table_nodes
       )
   );
 
@@ -642,61 +1309,74 @@ jieba__allocate_hash_table_nodes(size_t N, struct jieba__data_base *data_base) {
       data_base->hash_table_node_first_free == (size_t) -1 || (
         0 <= data_base->hash_table_node_first_free &&
         data_base->hash_table_node_first_free <=
-          jieba__hash_table_node_space_count(data_base->estimated_word_count)
+          data_base->space_counts.hash_table_nodes
       )
   );
   return res;
 }
 
-static void jieba__free_hash_table_node(
-    size_t pos, struct jieba__data_base *data_base
+/* gives N consecutive nodes back, merge them with the runs around */
+static void jieba__free_hash_table_nodes(
+    size_t pos, size_t N, struct jieba__data_base *data_base
 ) {
   struct jieba__hash_table_node *nodes = data_base->hash_table_nodes;
-  nodes[pos].next_node_pos = data_base->hash_table_node_first_free;
-  data_base->hash_table_node_first_free = pos;
-}
-
-static size_t
-jieba__allocate_hash_table_cell2(
-    struct jieba__data_base *data_base, struct jieba__hash_table_cell *cells,
-    size_t *hash_table_cell_first_free
-) {
-  if (*hash_table_cell_first_free == (size_t)-1) return -1;
-
-  size_t new_pos = *hash_table_cell_first_free;
-  data_base->hash_table_cell_first_free = cells[new_pos].next_cell_pos;
+  size_t last_run = (size_t)-1;
+  size_t run = data_base->hash_table_node_first_free;
+  while (run != (size_t)-1 && run < pos) {
+    last_run = run;
+    run = nodes[run].next_run_pos;
+  }
 
-  cells[new_pos].next_cell_pos = -1;
-  cells[new_pos].hash = 0;
-  cells[new_pos].string.count = 0;
+  nodes[pos].next_run_pos = run;
+  nodes[pos].free_count = N;
+  if (run != (size_t)-1 && pos + N == run) {
+    nodes[pos].next_run_pos = nodes[run].next_run_pos;
+    nodes[pos].free_count += nodes[run].free_count;
+  }
 
-  return new_pos;
+  if (last_run == (size_t)-1) {
+    data_base->hash_table_node_first_free = pos;
+  } else if (last_run + nodes[last_run].free_count == pos) {
+    nodes[last_run].next_run_pos = nodes[pos].next_run_pos;
+    nodes[last_run].free_count += nodes[pos].free_count;
+  } else {
+    nodes[last_run].next_run_pos = pos;
+  }
 }
 
-static size_t
-jieba__allocate_hash_table_cell(struct jieba__data_base *data_base) {
-  jieba__assert(
-      data_base->hash_table_cell_first_free == -1 || (
-        0 <= data_base->hash_table_cell_first_free &&
-        data_base->hash_table_cell_first_free <=
-          jieba__hash_table_cell_space_count(data_base->estimated_word_count)
-      )
-  );
+#if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CHAINING
+static void jieba__init_hash_table_buckets(
+    size_t pos, size_t N, struct jieba__hash_table_node *nodes
+) {
+  for (size_t i = pos; i < pos + N; i++) {
+    for (size_t j = 0; j < JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER; j++) {
+      nodes[i].buckets[j].count = 0;
+      nodes[i].buckets[j].first_cell_pos = (jieba__pos)-1;
+    }
+  }
+}
+#endif
 
-  size_t res =  jieba__allocate_hash_table_cell2(
-      data_base, data_base->hash_table_cells,
-      &data_base->hash_table_cell_first_free
-  );
+static size_t
+jieba__allocate_hash_table_cell(struct jieba__data_base *data_base) {
+  struct jieba__hash_table_cell *cells = data_base->hash_table_cells;
+  size_t new_pos = data_base->hash_table_cell_first_free;
+  if (new_pos != (size_t)-1) {
+    data_base->hash_table_cell_first_free =
+      jieba__pos_of(cells[new_pos].next_cell_pos);
+  } else if (data_base->hash_table_cell_frontier <
+             data_base->space_counts.cells) {
+    new_pos = data_base->hash_table_cell_frontier++;
+  } else {
+    return -1;
+  }
+  jieba__assert(new_pos < data_base->hash_table_cell_frontier);
 
-  jieba__assert(
-      data_base->hash_table_cell_first_free == -1 || (
-        0 <= data_base->hash_table_cell_first_free &&
-        data_base->hash_table_cell_first_free <=
-          jieba__hash_table_cell_space_count(data_base->estimated_word_count)
-      )
-  );
+  cells[new_pos].next_cell_pos = -1;
+  cells[new_pos].hash = 0;
+  cells[new_pos].key.string.count = 0;
 
-  return res;
+  return new_pos;
 }
 
 static void jieba__free_hash_table_cell(
@@ -708,11 +1388,11 @@ static void jieba__free_hash_table_cell(
 }
 
 static int jieba__init_and_allocate_string(
-    struct jieba__utf32be *contents, size_t contents_size,
+    const jieba__key_unit *contents, size_t contents_size,
     struct jieba__data_base *data_base, struct jieba__string *string
 ) {
   size_t new_size = contents_size + data_base->character_space_used;
-  if (new_size > data_base->character_space_size)
+  if (new_size > data_base->space_counts.characters)
     return -1;
   size_t strpos = data_base->character_space_used;
   data_base->character_space_used += contents_size;
@@ -723,11 +1403,80 @@ static int jieba__init_and_allocate_string(
   return 0;
 }
 
-/* primes */
-/* How could we give users the JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER macro if we use such a primes table? */
-const size_t jieba__hash_table_sizes[] = {
-  2039, 4093, 8179, 16369, 32749, 65497, 130987, 262007, 523997, 0
-};
+/* words of the same characters number may differ in utf 8 bytes number */
+static int jieba__string_equals(
+    const jieba__key_unit *word, size_t word_size,
+    const struct jieba__string *string, const jieba__key_unit *characterp
+) {
+  return string->count == word_size && !memcmp(
+      word, &characterp[string->first_character_pos],
+      sizeof(jieba__key_unit) * word_size
+  );
+}
+
+/* packs the first `count` characters, `count` is at most the max length */
+static void jieba__pack_key(
+    const struct jieba__utf32be *characters, size_t count, uint64_t *packed
+) {
+  for (size_t i = 0; i < JIEBA__PACKED_KEY_INTEGERS; i++) packed[i] = 0;
+  for (size_t i = 0; i < count; i++) {
+    size_t n = i / JIEBA__PACKED_KEY_PER_INTEGER;
+    packed[n] = packed[n] << JIEBA__PACKED_KEY_BITS
+      | jieba__code_point_of_u32be(characters[i]);
+  }
+}
+
+static int jieba__packed_key_equals(const uint64_t *a, const uint64_t *b) {
+  int res = a[0] == b[0];
+  for (size_t i = 1; i < JIEBA__PACKED_KEY_INTEGERS; i++)
+    res &= a[i] == b[i];
+  return res;
+}
+
+/* `packed` is NULL for a word too long to be packed */
+static int jieba__cell_key_equals(
+    const jieba__key_unit *word, size_t word_size, const uint64_t *packed,
+    jieba__cell_hash hash, const struct jieba__hash_table_cell *cell,
+    const jieba__key_unit *characterp
+) {
+  if (packed != NULL) return jieba__packed_key_equals(packed, cell->key.packed);
+  return cell->hash == hash &&
+    jieba__string_equals(word, word_size, &cell->key.string, characterp);
+}
+
+static int jieba__init_cell_key(
+    const jieba__key_unit *word, size_t word_size, const uint64_t *packed,
+    struct jieba__data_base *data_base, struct jieba__hash_table_cell *cell
+) {
+  if (packed == NULL)
+    return jieba__init_and_allocate_string(
+        word, word_size, data_base, &cell->key.string
+    );
+  for (size_t i = 0; i < JIEBA__PACKED_KEY_INTEGERS; i++)
+    cell->key.packed[i] = packed[i];
+  data_base->packed_key_units += word_size;
+  return 0;
+}
+
+/* maps a 32 bits random number to [0, n) without a division */
+static size_t jieba__fast_range32(uint32_t x, size_t n) {
+  jieba__assert(n <= UINT32_MAX);
+  return ((uint64_t)x * n) >> 32;
+}
+
+#if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CHAINING
+/* nodes of a table are consecutive, so its buckets are a plain array */
+static struct jieba__hash_table_bucket *jieba__hash_table_bucket_of(
+    jieba__cell_hash hash, struct jieba__hash_table *table,
+    struct jieba__hash_table_node *nodes
+) {
+  size_t idx = jieba__fast_range32((uint32_t)hash, table->size);
+  size_t node_num = idx / JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER;
+  size_t bucket_num = idx % JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER;
+  jieba__assert(table->first_node_pos != (size_t)-1);
+  jieba__assert(node_num < table->node_count);
+  return &nodes[table->first_node_pos + node_num].buckets[bucket_num];
+}
 
 static void
 jieba__hash_table_extend_coerce_insert_cell(
@@ -738,381 +1487,2686 @@ jieba__hash_table_extend_coerce_insert_cell(
   jieba__assert(
       0 <= cell_pos &&
       cell_pos <=
-        jieba__hash_table_cell_space_count(data_base->estimated_word_count)
+        data_base->space_counts.cells
   );
 
-  size_t hash = cells[cell_pos].hash;
-  size_t idx = hash % table->size;
-  size_t node_num = idx / JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER;
-  size_t bucket_num = idx % JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER;
-
-  size_t node_pos = table->first_node_pos;
-  jieba__assert(node_pos != (size_t)-1);
-  while (node_num--) {
-    node_pos = nodes[node_pos].next_node_pos;
-    jieba__assert(node_pos != (size_t)-1);
-  }
+  struct jieba__hash_table_bucket *bucket;
+  bucket = jieba__hash_table_bucket_of(cells[cell_pos].hash, table, nodes);
 
-  nodes[node_pos].buckets[bucket_num].count += 1;
-  cells[cell_pos].next_cell_pos =
-    nodes[node_pos].buckets[bucket_num].first_cell_pos;
-  nodes[node_pos].buckets[bucket_num].first_cell_pos = cell_pos;
+  bucket->count += 1;
+  cells[cell_pos].next_cell_pos = bucket->first_cell_pos;
+  bucket->first_cell_pos = cell_pos;
 
   table->count += 1;
 }
 
+/* unlinks all cells of a bucket and pushes them to a cell list */
 static void
-jieba__hash_table_extend_coerce_insert_bucket(
-    struct jieba__hash_table_bucket *bucket, struct jieba__hash_table *table,
-    struct jieba__hash_table_cell *cells, struct jieba__hash_table_node *nodes,
-    struct jieba__data_base *data_base
+jieba__hash_table_extend_collect_bucket(
+    struct jieba__hash_table_bucket *bucket, size_t *cell_list,
+    struct jieba__hash_table_cell *cells
 ) {
   while (bucket->count-- > 0) {
     size_t pos = bucket->first_cell_pos;
     bucket->first_cell_pos = cells[pos].next_cell_pos;
-    jieba__hash_table_extend_coerce_insert_cell(
-        pos, table, cells, nodes, data_base
-    );
+    cells[pos].next_cell_pos = *cell_list;
+    *cell_list = pos;
   }
 }
 
+/*
+ * The cells are collected before the old nodes are freed, so the new nodes
+ * could be merged from the old ones and the free run next to them. The table
+ * keeps its nodes if there are no `node_number` nodes.
+ */
 static int
-jieba__hash_table_extend(
-    struct jieba__hash_table *table, struct jieba__data_base *data_base,
-    struct jieba__hash_table_node *nodes
+jieba__hash_table_resize(
+    struct jieba__hash_table *table, size_t node_number,
+    struct jieba__data_base *data_base, struct jieba__hash_table_node *nodes
 ) {
-  jieba__log("hash table extended\n");
+  jieba__log("hash table resized to %zu nodes\n", node_number);
 
   size_t original_size = table->size;
-  size_t size;
-  int got_size = 0;
-  for (size_t i = 0; jieba__hash_table_sizes[i + 1] != 0; i++) {
-    if (original_size == jieba__hash_table_sizes[i]) {
-      size = jieba__hash_table_sizes[i + 1];
-      got_size = 1;
-      break;
+  size_t size = node_number * JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER;
+  if (size > UINT32_MAX) return -1;
+
+  size_t cell_list = (size_t)-1;
+  for (size_t n = 0; n < table->node_count; n++) {
+    size_t old_node = table->first_node_pos + n;
+    jieba__assert(
+        0 <= old_node &&
+        old_node <=
+          data_base->space_counts.hash_table_nodes
+    );
+    for (size_t i = 0; i < JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER; i++) {
+      jieba__hash_table_extend_collect_bucket(
+          &nodes[old_node].buckets[i], &cell_list, data_base->hash_table_cells
+      );
     }
   }
-  if (!got_size) return -1;
+  jieba__free_hash_table_nodes(
+      table->first_node_pos, table->node_count, data_base
+  );
 
-  size_t node_number = (size + JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER - 1)
-    / JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER;
+  int res = 0;
   size_t new_pos = jieba__allocate_hash_table_nodes(node_number, data_base);
   if (new_pos == (size_t)-1) {
-    jieba__log("hash table extending fail since no enough hash table nodes\n");
-    return -1;
+    jieba__log("hash table resizing fail since no enough hash table nodes\n");
+    /* the old nodes were just freed, so this could not fail */
+    size = original_size;
+    node_number = table->node_count;
+    new_pos = jieba__allocate_hash_table_nodes(node_number, data_base);
+    jieba__assert(new_pos != (size_t)-1);
+    res = -1;
   }
-  
-  size_t old_node = table->first_node_pos;
-  size_t old_size = table->size;
+  jieba__init_hash_table_buckets(new_pos, node_number, nodes);
+
   table->count = 0;
   table->size = size;
   table->first_node_pos = new_pos;
+  table->node_count = node_number;
 
-  while (old_node != -1) {
-    jieba__assert(
-        0 <= old_node &&
-        old_node <=
-          jieba__hash_table_node_space_count(data_base->estimated_word_count)
+  while (cell_list != (size_t)-1) {
+    size_t pos = cell_list;
+    cell_list = jieba__pos_of(data_base->hash_table_cells[pos].next_cell_pos);
+    jieba__hash_table_extend_coerce_insert_cell(
+        pos, table, data_base->hash_table_cells, nodes, data_base
     );
-    for (size_t i = 0; i < JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER; i++) {
-      jieba__hash_table_extend_coerce_insert_bucket(
-          &nodes[old_node].buckets[i], table, data_base->hash_table_cells,
-          nodes, data_base
-      );
-    }
-    size_t next_node_pos = nodes[old_node].next_node_pos;
-    jieba__free_hash_table_node(old_node, data_base);
-    old_node = next_node_pos;
   }
-  return 0;
+  return res;
 }
 
-int jieba__ensure_hash_table_has_node(
-    struct jieba__hash_table *table, struct jieba__data_base *data_base
+static int
+jieba__hash_table_extend(
+    struct jieba__hash_table *table, struct jieba__data_base *data_base,
+    struct jieba__hash_table_node *nodes
 ) {
-  if (table->size == 0) {
-    jieba__log("allocated hash node for empty hash table\n");
-    table->count = 0;
-    table->size = jieba__hash_table_sizes[0];
-    size_t new_pos = jieba__allocate_hash_table_nodes(1, data_base);
-    if (new_pos == (size_t)-1) return -1;
-    table->first_node_pos = new_pos;
-  }
-  return 0;
+  return jieba__hash_table_resize(
+      table, table->node_count * 2, data_base, nodes
+  );
 }
+#endif
 
-enum jieba__bucket_find_or_add_cell_result {
-  JIEBA__BUCKET_FIND_OR_ADD_CELL_SUCCESS,
-  JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NOMEM,
-  JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NEED_EXTEND
-};
+#if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_SWISS
+static size_t jieba__swiss_group_count(size_t node_count) {
+  return node_count * sizeof(struct jieba__hash_table_node)
+    / (JIEBA__SWISS_GROUP_WIDTH * (1 + sizeof(jieba__pos)));
+}
 
-static enum jieba__bucket_find_or_add_cell_result
-jieba__bucket_find_or_add_cell(
-    struct jieba__utf32be *word, size_t word_size, uint64_t hash,
-    struct jieba__data_base *data_base, size_t tried_times,
-    struct jieba__hash_table *table, struct jieba__hash_table_bucket *bucket,
-    struct jieba__utf32be *characterp, struct jieba__hash_table_cell *cells,
-    int *does_change, size_t *cell_pos
+static uint8_t *jieba__swiss_controls(
+    struct jieba__hash_table *table, struct jieba__hash_table_node *nodes
 ) {
-  if (bucket->count == 0) {
-    size_t new_pos = jieba__allocate_hash_table_cell(data_base);
-    if (new_pos == (size_t)-1) return JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NOMEM;
-
-    cells[new_pos].hash = hash;
-    int res = jieba__init_and_allocate_string(
-        word, word_size, data_base, &cells[new_pos].string
-    );
-    if (res != 0) {
-      jieba__free_hash_table_cell(new_pos, data_base);
-      return JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NOMEM;
-    }
-
-    bucket->count = 1;
-    bucket->first_cell_pos = new_pos;
-    table->count += 1;
-    *does_change = 1;
-    *cell_pos = new_pos;
-    return JIEBA__BUCKET_FIND_OR_ADD_CELL_SUCCESS;
-  } else {
-    size_t a_cell_pos = bucket->first_cell_pos;
-    size_t last_cell_pos = -1;
-    for (size_t i = 0; i < bucket->count; i++) {
-      jieba__assert(
-          0 <= a_cell_pos &&
-          a_cell_pos <=
-            jieba__hash_table_cell_space_count(data_base->estimated_word_count)
-      );
+  return (uint8_t *)&nodes[table->first_node_pos];
+}
 
-      size_t character_pos = cells[a_cell_pos].string.first_character_pos;
+static jieba__pos *jieba__swiss_slots(
+    struct jieba__hash_table *table, struct jieba__hash_table_node *nodes
+) {
+  return (jieba__pos *)(
+      jieba__swiss_controls(table, nodes)
+        + table->size * JIEBA__SWISS_GROUP_WIDTH
+  );
+}
 
-      if (hash == cells[a_cell_pos].hash &&
-          !memcmp(
-            word, &characterp[character_pos],
-            sizeof(struct jieba__utf32be) * word_size
-          )
-      ) {
-        *does_change = 0;
-        *cell_pos = a_cell_pos;
-        return JIEBA__BUCKET_FIND_OR_ADD_CELL_SUCCESS;
-      }
+/* index of the lowest set bit, mask should not be 0 */
+static size_t jieba__swiss_lowest(unsigned int mask) {
+  jieba__assert(mask != 0);
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctz(mask);
+#else
+  size_t n = 0;
+  while (!(mask & 1)) { mask >>= 1; n++; }
+  return n;
+#endif
+}
 
-      last_cell_pos = a_cell_pos;
-      a_cell_pos = cells[a_cell_pos].next_cell_pos;
-    }
+/* bit i is set if the i-th control byte of the group is `control` */
+static unsigned int jieba__swiss_match(const uint8_t *group, uint8_t control) {
+#if JIEBA_SSE2
+  __m128i controls = _mm_loadu_si128((const __m128i *)group);
+  __m128i matches = _mm_cmpeq_epi8(controls, _mm_set1_epi8((char)control));
+  return (unsigned int)_mm_movemask_epi8(matches);
+#else
+  unsigned int mask = 0;
+  for (unsigned int i = 0; i < JIEBA__SWISS_GROUP_WIDTH; i++)
+    mask |= (unsigned int)(group[i] == control) << i;
+  return mask;
+#endif
+}
 
-    jieba__assert(a_cell_pos == (size_t)-1);
+static size_t jieba__swiss_slots_of_nodes(
+    size_t pos, size_t node_count, struct jieba__hash_table *table,
+    struct jieba__hash_table_node *nodes
+) {
+  table->first_node_pos = pos;
+  table->node_count = node_count;
+  table->size = jieba__swiss_group_count(node_count);
+  memset(
+      jieba__swiss_controls(table, nodes), JIEBA__SWISS_EMPTY,
+      table->size * JIEBA__SWISS_GROUP_WIDTH
+  );
+  return table->size * JIEBA__SWISS_GROUP_WIDTH;
+}
 
-    if (bucket->count == table->max_cell_per_bucket) {
-      jieba__log(
-          "hash table %p bucket %p is fill"
-          ", try extending or increase bucket size\n",
-          table, bucket
-      );
-      if (tried_times == 0)
-        return JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NEED_EXTEND;
-      else
-        table->max_cell_per_bucket += 1;
+/*
+ * Probes groups from the one the hash points to. Since a cell is never
+ * removed, a group with an empty slot ends the probing, and the slot is where
+ * the word should be put. Returns the slot, and sets `cell_pos` if the word
+ * is found. `word` could be NULL to only look for an empty slot.
+ */
+static size_t jieba__swiss_probe(
+    const jieba__key_unit *word, size_t word_size, const uint64_t *packed,
+    jieba__cell_hash hash, struct jieba__hash_table *table,
+    struct jieba__data_base *data_base, size_t *cell_pos
+) {
+  uint8_t *controls = jieba__swiss_controls(table, data_base->hash_table_nodes);
+  jieba__pos *slots = jieba__swiss_slots(table, data_base->hash_table_nodes);
+  struct jieba__hash_table_cell *cells = data_base->hash_table_cells;
+  uint8_t tag = hash & 0x7f;
+  size_t group = jieba__fast_range32((uint32_t)hash, table->size);
+
+  *cell_pos = (size_t)-1;
+  for (size_t i = 0; i < table->size; i++) {
+    const uint8_t *controls_of_group =
+      &controls[group * JIEBA__SWISS_GROUP_WIDTH];
+
+    if (word != NULL) {
+      unsigned int mask = jieba__swiss_match(controls_of_group, tag);
+      while (mask != 0) {
+        size_t slot = group * JIEBA__SWISS_GROUP_WIDTH
+          + jieba__swiss_lowest(mask);
+        size_t a_cell_pos = slots[slot];
+        if (jieba__cell_key_equals(
+              word, word_size, packed, hash, &cells[a_cell_pos],
+              data_base->characterp
+            )
+        ) {
+          *cell_pos = a_cell_pos;
+          return slot;
+        }
+        mask &= mask - 1;
+      }
     }
 
-    size_t new_pos = jieba__allocate_hash_table_cell(data_base);
-    if (new_pos == (size_t)-1) return JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NOMEM;
-
-    cells[new_pos].hash = hash;
-    int res = jieba__init_and_allocate_string(
-        word, word_size, data_base, &cells[new_pos].string
+    unsigned int empty = jieba__swiss_match(
+        controls_of_group, JIEBA__SWISS_EMPTY
     );
-    if (res != 0) {
-      jieba__free_hash_table_cell(new_pos, data_base);
-      return JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NOMEM;
-    }
+    if (empty != 0)
+      return group * JIEBA__SWISS_GROUP_WIDTH + jieba__swiss_lowest(empty);
 
-    bucket->count += 1;
-    cells[last_cell_pos].next_cell_pos = new_pos;
-    table->count += 1;
-    *does_change = 1;
-    *cell_pos = new_pos;
-    return JIEBA__BUCKET_FIND_OR_ADD_CELL_SUCCESS;
+    group = group + 1 == table->size ? 0 : group + 1;
   }
+  return (size_t)-1;
 }
 
-static enum jieba_add_word_result
-jieba__hash_table_find_or_add_cell(
-    struct jieba__utf32be *word, size_t word_size, uint64_t hash,
-    struct jieba__data_base *data_base, struct jieba__hash_table *table,
-    int *does_change, size_t *cell_pos
+static void jieba__swiss_put(
+    size_t slot, size_t cell_pos, jieba__cell_hash hash,
+    struct jieba__hash_table *table, struct jieba__hash_table_node *nodes
 ) {
-  if (jieba__ensure_hash_table_has_node(table, data_base) != 0)
-    return JIEBA_ADD_WORD_FAIL_NOMEM;
-
-  size_t tried_times = 0;
-  int need_extend = 0;
+  jieba__swiss_controls(table, nodes)[slot] = hash & 0x7f;
+  jieba__swiss_slots(table, nodes)[slot] = cell_pos;
+  table->count += 1;
+}
 
-  while (1) {
-    size_t idx = hash % table->size;
-    size_t node_num = idx / JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER;
-    size_t bucket_num = idx % JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER;
+/* moves the table to `node_number` nodes, the same way as a chaining one */
+static int jieba__swiss_resize(
+    struct jieba__hash_table *table, size_t node_number,
+    struct jieba__data_base *data_base
+) {
+  jieba__log("swiss table resized to %zu nodes\n", node_number);
 
-    size_t node_pos = table->first_node_pos;
-    jieba__assert(
-        0 <= node_pos &&
-        node_pos <=
-          jieba__hash_table_node_space_count(data_base->estimated_word_count)
-    );
+  struct jieba__hash_table_node *nodes = data_base->hash_table_nodes;
+  struct jieba__hash_table_cell *cells = data_base->hash_table_cells;
+  uint8_t *controls = jieba__swiss_controls(table, nodes);
+  jieba__pos *slots = jieba__swiss_slots(table, nodes);
+
+  size_t cell_list = (size_t)-1;
+  for (size_t i = 0; i < table->size * JIEBA__SWISS_GROUP_WIDTH; i++) {
+    if (controls[i] == JIEBA__SWISS_EMPTY) continue;
+    cells[slots[i]].next_cell_pos = cell_list;
+    cell_list = slots[i];
+  }
+  jieba__free_hash_table_nodes(
+      table->first_node_pos, table->node_count, data_base
+  );
 
-    while (node_num--) {
-      node_pos = data_base->hash_table_nodes[node_pos].next_node_pos;
-      jieba__assert(
-          0 <= node_pos &&
-          node_pos <=
-            jieba__hash_table_node_space_count(data_base->estimated_word_count)
-      );
-    }
+  int res = 0;
+  size_t new_pos = jieba__allocate_hash_table_nodes(node_number, data_base);
+  if (new_pos == (size_t)-1) {
+    jieba__log("swiss table resizing fail since no enough hash table nodes\n");
+    /* the old nodes were just freed, so this could not fail */
+    node_number = table->node_count;
+    new_pos = jieba__allocate_hash_table_nodes(node_number, data_base);
+    jieba__assert(new_pos != (size_t)-1);
+    res = -1;
+  }
+  jieba__swiss_slots_of_nodes(new_pos, node_number, table, nodes);
+  table->count = 0;
 
-    enum jieba__bucket_find_or_add_cell_result res;
-    res = jieba__bucket_find_or_add_cell(
-        word, word_size, hash, data_base, tried_times, table,
-        &data_base->hash_table_nodes[node_pos].buckets[bucket_num],
-        data_base->characterp, data_base->hash_table_cells, does_change,
-        cell_pos
+  while (cell_list != (size_t)-1) {
+    size_t pos = cell_list, a_cell_pos;
+    cell_list = jieba__pos_of(cells[pos].next_cell_pos);
+    cells[pos].next_cell_pos = -1;
+    size_t slot = jieba__swiss_probe(
+        NULL, 0, NULL, cells[pos].hash, table, data_base, &a_cell_pos
     );
-    switch (res) {
-    case JIEBA__BUCKET_FIND_OR_ADD_CELL_SUCCESS:
-      return JIEBA_ADD_WORD_SUCCESS;
-    case JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NEED_EXTEND:
-      need_extend = 1;
-      break;
-    case JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NOMEM:
-      return JIEBA_ADD_WORD_FAIL_NOMEM;
-    }
-
-    tried_times += 1;
-    jieba__assert(tried_times <= 1);
-
-    if (need_extend) {
-      size_t res = jieba__hash_table_extend(
-          table, data_base, data_base->hash_table_nodes
-      );
-      if (res != 0) {
-        return JIEBA_ADD_WORD_FAIL_NOMEM;
-      }
-    }
+    jieba__assert(slot != (size_t)-1);
+    jieba__swiss_put(slot, pos, cells[pos].hash, table, nodes);
   }
+  return res;
 }
 
-static enum jieba_add_word_result
-jieba__add_word(
-    unsigned char *restrict word, size_t word_size,
-    struct jieba__data_base *restrict data_base
+static int jieba__swiss_extend(
+    struct jieba__hash_table *table, struct jieba__data_base *data_base
 ) {
-  jieba__log("adding %s\n", word);
-
-  static struct jieba__utf32be c32str_cache[128];
-  enum jieba_add_word_result res;
+  return jieba__swiss_resize(table, table->node_count * 2, data_base);
+}
 
-  size_t c32str_cache_size = (size_t)-1;
-  enum jieba__mbtoc32be_result mbtoc32be_res;
-  mbtoc32be_res = jieba__mbtoc32bestr(
-      word, word_size, c32str_cache, &c32str_cache_size
+static enum jieba_add_word_result
+jieba__swiss_find_or_add_cell(
+    const jieba__key_unit *word, size_t word_size, const uint64_t *packed,
+    jieba__cell_hash hash, struct jieba__data_base *data_base,
+    struct jieba__hash_table *table, int *does_change, size_t *cell_pos
+) {
+  size_t slot = jieba__swiss_probe(
+      word, word_size, packed, hash, table, data_base, cell_pos
   );
-  switch (mbtoc32be_res) {
-  case JIEBA__MBTOC32BE_SUCCESS:
-    break;
-  case JIEBA__MBTOC32BE_BAD_UTF8:
-    return JIEBA_ADD_WORD_BAD_UTF8;
-  case JIEBA__MBTOC32BE_NO_ENOUGH_CHARACTER:
-    return JIEBA_ADD_WORD_NO_ENOUGH_CHARACTER;
+  if (*cell_pos != (size_t)-1) {
+    *does_change = 0;
+    return JIEBA_ADD_WORD_SUCCESS;
   }
 
-  if (c32str_cache_size == 0 || c32str_cache_size == 1)
-    return JIEBA_ADD_WORD_SUCCESS;
+  /* keeps the load under 7/8, or at least one slot empty if it can't grow */
+  size_t slot_count = table->size * JIEBA__SWISS_GROUP_WIDTH;
+  if ((table->count + 1) * 8 > slot_count * 7) {
+    if (jieba__swiss_extend(table, data_base) != 0 &&
+        table->count + 1 >= slot_count)
+      return JIEBA_ADD_WORD_FAIL_NOMEM;
+    slot = jieba__swiss_probe(
+        word, word_size, packed, hash, table, data_base, cell_pos
+    );
+  }
+  jieba__assert(slot != (size_t)-1);
 
-  if (c32str_cache_size > JIEBA_MAX_WORD_LENGTH)
-    return JIEBA_ADD_WORD_FAIL_TOO_LONG;
+  size_t new_pos = jieba__allocate_hash_table_cell(data_base);
+  if (new_pos == (size_t)-1) return JIEBA_ADD_WORD_FAIL_NOMEM;
 
-  size_t data_base_node_pos;
-  res = jieba__find_data_base_node(
-      c32str_cache_size, data_base, &data_base_node_pos
+  struct jieba__hash_table_cell *cells = data_base->hash_table_cells;
+  cells[new_pos].hash = hash;
+  int res = jieba__init_cell_key(
+      word, word_size, packed, data_base, &cells[new_pos]
   );
-  if (res != JIEBA_ADD_WORD_SUCCESS) return res;
+  if (res != 0) {
+    jieba__free_hash_table_cell(new_pos, data_base);
+    return JIEBA_ADD_WORD_FAIL_NOMEM;
+  }
 
-  uint64_t hash = jieba__hash_u32bearr(c32str_cache, c32str_cache_size);
-  size_t cell;
+  jieba__swiss_put(slot, new_pos, hash, table, data_base->hash_table_nodes);
+  *does_change = 1;
+  *cell_pos = new_pos;
+  return JIEBA_ADD_WORD_SUCCESS;
+}
+#endif
+
+#if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CUCKOO
+static struct jieba__cuckoo_bucket *jieba__cuckoo_buckets(
+    struct jieba__hash_table *table, struct jieba__hash_table_node *nodes
+) {
+  return (struct jieba__cuckoo_bucket *)&nodes[table->first_node_pos];
+}
+
+static uint8_t jieba__cuckoo_tag(jieba__cell_hash hash) {
+  uint8_t tag = hash & 0xff;
+  return tag == 0 ? 1 : tag;
+}
+
+/* the second bucket is from the hash remixed, so cells could be kicked */
+static void jieba__cuckoo_buckets_of(
+    jieba__cell_hash hash, struct jieba__hash_table *table,
+    size_t *first, size_t *second
+) {
+  uint32_t h = (uint32_t)hash;
+  *first = jieba__fast_range32(h, table->size);
+  h ^= h >> 16; h *= 0x85ebca6b;
+  h ^= h >> 13; h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  *second = jieba__fast_range32(h, table->size);
+}
+
+static size_t jieba__cuckoo_buckets_of_nodes(
+    size_t pos, size_t node_count, struct jieba__hash_table *table,
+    struct jieba__hash_table_node *nodes
+) {
+  table->first_node_pos = pos;
+  table->node_count = node_count;
+  table->size = node_count * sizeof(struct jieba__hash_table_node)
+    / sizeof(struct jieba__cuckoo_bucket);
+  struct jieba__cuckoo_bucket *buckets = jieba__cuckoo_buckets(table, nodes);
+  for (size_t i = 0; i < table->size; i++)
+    memset(buckets[i].tags, 0, JIEBA__CUCKOO_SLOTS);
+  return table->size * JIEBA__CUCKOO_SLOTS;
+}
+
+/* returns the cell of the word, or -1 */
+static size_t jieba__cuckoo_find(
+    const jieba__key_unit *word, size_t word_size, const uint64_t *packed,
+    jieba__cell_hash hash, struct jieba__hash_table *table,
+    struct jieba__data_base *data_base
+) {
+  struct jieba__cuckoo_bucket *buckets =
+    jieba__cuckoo_buckets(table, data_base->hash_table_nodes);
+  struct jieba__hash_table_cell *cells = data_base->hash_table_cells;
+  uint8_t tag = jieba__cuckoo_tag(hash);
+  size_t bucket_pos[2];
+  jieba__cuckoo_buckets_of(hash, table, &bucket_pos[0], &bucket_pos[1]);
+
+  for (size_t k = 0; k < 2; k++) {
+    struct jieba__cuckoo_bucket *bucket = &buckets[bucket_pos[k]];
+    for (size_t i = 0; i < JIEBA__CUCKOO_SLOTS; i++) {
+      if (bucket->tags[i] != tag) continue;
+      size_t a_cell_pos = bucket->cells[i];
+      if (jieba__cell_key_equals(
+            word, word_size, packed, hash, &cells[a_cell_pos],
+            data_base->characterp
+          )
+      )
+        return a_cell_pos;
+    }
+  }
+
+  size_t cell_pos = table->first_stash_cell_pos;
+  for (size_t i = 0; i < table->stash_count; i++) {
+    if (jieba__cell_key_equals(
+          word, word_size, packed, hash, &cells[cell_pos],
+          data_base->characterp
+        )
+    )
+      return cell_pos;
+    cell_pos = jieba__pos_of(cells[cell_pos].next_cell_pos);
+  }
+  return (size_t)-1;
+}
+
+static int jieba__cuckoo_put_in_bucket(
+    size_t cell_pos, uint8_t tag, struct jieba__cuckoo_bucket *bucket
+) {
+  for (size_t i = 0; i < JIEBA__CUCKOO_SLOTS; i++) {
+    if (bucket->tags[i] != 0) continue;
+    bucket->tags[i] = tag;
+    bucket->cells[i] = cell_pos;
+    return 0;
+  }
+  return -1;
+}
+
+/*
+ * A cell with both buckets full kicks a cell out of one of them, which then
+ * goes to its other bucket, and so on. A cell still homeless after
+ * JIEBA__CUCKOO_MAX_KICKS kicks is stashed. If the stash is full, -1 is
+ * returned and that cell is left out, so the table should be dropped.
+ */
+static int jieba__cuckoo_put(
+    size_t cell_pos, struct jieba__hash_table *table,
+    struct jieba__data_base *data_base
+) {
+  struct jieba__cuckoo_bucket *buckets =
+    jieba__cuckoo_buckets(table, data_base->hash_table_nodes);
+  struct jieba__hash_table_cell *cells = data_base->hash_table_cells;
+  size_t kicked_from = (size_t)-1;
+
+  table->count += 1;
+  for (size_t kick = 0; kick < JIEBA__CUCKOO_MAX_KICKS; kick++) {
+    jieba__cell_hash hash = cells[cell_pos].hash;
+    uint8_t tag = jieba__cuckoo_tag(hash);
+    size_t first, second;
+    jieba__cuckoo_buckets_of(hash, table, &first, &second);
+    if (jieba__cuckoo_put_in_bucket(cell_pos, tag, &buckets[first]) == 0 ||
+        jieba__cuckoo_put_in_bucket(cell_pos, tag, &buckets[second]) == 0)
+      return 0;
+
+    /* never kicks back into the bucket the cell was just kicked out of */
+    size_t b = first == kicked_from ? second : first;
+    size_t slot = ((hash >> 8) + kick) % JIEBA__CUCKOO_SLOTS;
+    size_t kicked = buckets[b].cells[slot];
+    buckets[b].tags[slot] = tag;
+    buckets[b].cells[slot] = cell_pos;
+    cell_pos = kicked;
+    kicked_from = b;
+  }
+
+  if (table->stash_count == JIEBA__CUCKOO_MAX_STASH) return -1;
+  cells[cell_pos].next_cell_pos = table->first_stash_cell_pos;
+  table->first_stash_cell_pos = cell_pos;
+  table->stash_count += 1;
+  return 0;
+}
+
+/*
+ * Puts the cells of `table` in a new table of `node_number` nodes, while
+ * the old one is kept. If the stash of the new one overflows, it is dropped
+ * and a table twice as large is tried, until there are no nodes for it, when
+ * the old table is left as it was and -1 is returned.
+ */
+static int jieba__cuckoo_resize(
+    struct jieba__hash_table *table, size_t node_number,
+    struct jieba__data_base *data_base
+) {
+  jieba__log("cuckoo table resized to %zu nodes\n", node_number);
+
+  struct jieba__hash_table_node *nodes = data_base->hash_table_nodes;
+  struct jieba__hash_table_cell *cells = data_base->hash_table_cells;
+  struct jieba__cuckoo_bucket *buckets = jieba__cuckoo_buckets(table, nodes);
+
+  /* the links of the stash are taken by the new table */
+  size_t stashed[JIEBA__CUCKOO_MAX_STASH];
+  size_t cell_pos = table->first_stash_cell_pos;
+  for (size_t i = 0; i < table->stash_count; i++) {
+    stashed[i] = cell_pos;
+    cell_pos = jieba__pos_of(cells[cell_pos].next_cell_pos);
+  }
+
+  for (;;) {
+    size_t new_pos = jieba__allocate_hash_table_nodes(node_number, data_base);
+    if (new_pos == (size_t)-1) break;
+
+    struct jieba__hash_table resized = *table;
+    jieba__cuckoo_buckets_of_nodes(new_pos, node_number, &resized, nodes);
+    resized.count = 0;
+    resized.stash_count = 0;
+    resized.first_stash_cell_pos = -1;
+
+    int res = 0;
+    for (size_t i = 0; i < table->size && res == 0; i++) {
+      for (size_t j = 0; j < JIEBA__CUCKOO_SLOTS && res == 0; j++) {
+        if (buckets[i].tags[j] == 0) continue;
+        cells[buckets[i].cells[j]].next_cell_pos = -1;
+        res = jieba__cuckoo_put(buckets[i].cells[j], &resized, data_base);
+      }
+    }
+    for (size_t i = 0; i < table->stash_count && res == 0; i++) {
+      cells[stashed[i]].next_cell_pos = -1;
+      res = jieba__cuckoo_put(stashed[i], &resized, data_base);
+    }
+
+    if (res == 0) {
+      jieba__free_hash_table_nodes(
+          table->first_node_pos, table->node_count, data_base
+      );
+      *table = resized;
+      return 0;
+    }
+    jieba__log("cuckoo table stash overflows at %zu nodes\n", node_number);
+    jieba__free_hash_table_nodes(new_pos, node_number, data_base);
+    node_number *= 2;
+  }
+
+  jieba__log("cuckoo table resizing fail, no enough hash table nodes\n");
+  /* the stash is linked back as it was */
+  for (size_t i = 0; i < table->stash_count; i++) {
+    cells[stashed[i]].next_cell_pos = -1;
+    if (i + 1 < table->stash_count)
+      cells[stashed[i]].next_cell_pos = stashed[i + 1];
+  }
+  return -1;
+}
+
+static int jieba__cuckoo_extend(
+    struct jieba__hash_table *table, struct jieba__data_base *data_base
+) {
+  return jieba__cuckoo_resize(table, table->node_count * 2, data_base);
+}
+
+static enum jieba_add_word_result
+jieba__cuckoo_find_or_add_cell(
+    const jieba__key_unit *word, size_t word_size, const uint64_t *packed,
+    jieba__cell_hash hash, struct jieba__data_base *data_base,
+    struct jieba__hash_table *table, int *does_change, size_t *cell_pos
+) {
+  *cell_pos = jieba__cuckoo_find(
+      word, word_size, packed, hash, table, data_base
+  );
+  if (*cell_pos != (size_t)-1) {
+    *does_change = 0;
+    return JIEBA_ADD_WORD_SUCCESS;
+  }
+
+  /*
+   * Keeps the load under 15/16 so kicks end soon, and the stash short. If
+   * the table can't grow, a word is still taken while the stash has room.
+   */
+  size_t slot_count = table->size * JIEBA__CUCKOO_SLOTS;
+  if ((table->count + 1) * 16 > slot_count * 15)
+    jieba__cuckoo_extend(table, data_base);
+  while (table->stash_count == JIEBA__CUCKOO_MAX_STASH) {
+    if (jieba__cuckoo_extend(table, data_base) != 0)
+      return JIEBA_ADD_WORD_FAIL_NOMEM;
+  }
+
+  size_t new_pos = jieba__allocate_hash_table_cell(data_base);
+  if (new_pos == (size_t)-1) return JIEBA_ADD_WORD_FAIL_NOMEM;
+
+  struct jieba__hash_table_cell *cells = data_base->hash_table_cells;
+  cells[new_pos].hash = hash;
+  int res = jieba__init_cell_key(
+      word, word_size, packed, data_base, &cells[new_pos]
+  );
+  if (res != 0) {
+    jieba__free_hash_table_cell(new_pos, data_base);
+    return JIEBA_ADD_WORD_FAIL_NOMEM;
+  }
+
+  /* the stash has room, so the cell always finds a place */
+  jieba__cuckoo_put(new_pos, table, data_base);
+  *does_change = 1;
+  *cell_pos = new_pos;
+  return JIEBA_ADD_WORD_SUCCESS;
+}
+#endif
+
+/* gives an empty table without nodes its first `node_number` nodes */
+static int jieba__hash_table_allocate(
+    struct jieba__hash_table *table, size_t node_number,
+    struct jieba__data_base *data_base
+) {
+  jieba__assert(table->size == 0);
+  jieba__log("allocated %zu hash nodes for empty hash table\n", node_number);
+  table->count = 0;
+  size_t new_pos = jieba__allocate_hash_table_nodes(node_number, data_base);
+  if (new_pos == (size_t)-1) return -1;
+#if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_SWISS
+  jieba__swiss_slots_of_nodes(
+      new_pos, node_number, table, data_base->hash_table_nodes
+  );
+#elif JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CUCKOO
+  jieba__cuckoo_buckets_of_nodes(
+      new_pos, node_number, table, data_base->hash_table_nodes
+  );
+#else
+  table->size = node_number * JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER;
+  jieba__init_hash_table_buckets(
+      new_pos, node_number, data_base->hash_table_nodes
+  );
+  table->first_node_pos = new_pos;
+  table->node_count = node_number;
+#endif
+  return 0;
+}
+
+int jieba__ensure_hash_table_has_node(
+    struct jieba__hash_table *table, struct jieba__data_base *data_base
+) {
+  if (table->size == 0) return jieba__hash_table_allocate(table, 1, data_base);
+  return 0;
+}
+
+/*
+ * Words a table of `node_count` nodes takes before it grows. A chaining table
+ * grows only when a bucket is full, one word per bucket leaves it room.
+ */
+static size_t jieba__hash_table_capacity(size_t node_count) {
+#if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_SWISS
+  return jieba__swiss_group_count(node_count) * JIEBA__SWISS_GROUP_WIDTH
+    * 7 / 8;
+#elif JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CUCKOO
+  return node_count * sizeof(struct jieba__hash_table_node)
+    / sizeof(struct jieba__cuckoo_bucket) * JIEBA__CUCKOO_SLOTS * 15 / 16;
+#else
+  return node_count * JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER;
+#endif
+}
+
+/*
+ * Sizes a table for `count` words at once, so they are added with no
+ * extending. It is only a hint, the table is left as it is if there are no
+ * enough nodes.
+ */
+static size_t jieba__hash_table_node_number(size_t count) {
+  size_t node_number = count / jieba__hash_table_capacity(1);
+  if (node_number == 0) node_number = 1;
+  while (jieba__hash_table_capacity(node_number) < count) node_number++;
+  return node_number;
+}
+
+static void jieba__hash_table_reserve(
+    struct jieba__hash_table *table, size_t count,
+    struct jieba__data_base *data_base
+) {
+  size_t node_number = jieba__hash_table_node_number(count);
+
+  if (table->size == 0) {
+    jieba__hash_table_allocate(table, node_number, data_base);
+  } else if (table->node_count < node_number) {
+#if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_SWISS
+    jieba__swiss_resize(table, node_number, data_base);
+#elif JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CUCKOO
+    jieba__cuckoo_resize(table, node_number, data_base);
+#else
+    jieba__hash_table_resize(
+        table, node_number, data_base, data_base->hash_table_nodes
+    );
+#endif
+  }
+}
+
+#if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CHAINING
+enum jieba__bucket_find_or_add_cell_result {
+  JIEBA__BUCKET_FIND_OR_ADD_CELL_SUCCESS,
+  JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NOMEM,
+  JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NEED_EXTEND
+};
+
+static enum jieba__bucket_find_or_add_cell_result
+jieba__bucket_find_or_add_cell(
+    const jieba__key_unit *word, size_t word_size, const uint64_t *packed,
+    jieba__cell_hash hash, struct jieba__data_base *data_base,
+    size_t tried_times, struct jieba__hash_table *table,
+    struct jieba__hash_table_bucket *bucket,
+    jieba__key_unit *characterp, struct jieba__hash_table_cell *cells,
+    int *does_change, size_t *cell_pos
+) {
+  if (bucket->count == 0) {
+    size_t new_pos = jieba__allocate_hash_table_cell(data_base);
+    if (new_pos == (size_t)-1) return JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NOMEM;
+
+    cells[new_pos].hash = hash;
+    int res = jieba__init_cell_key(
+        word, word_size, packed, data_base, &cells[new_pos]
+    );
+    if (res != 0) {
+      jieba__free_hash_table_cell(new_pos, data_base);
+      return JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NOMEM;
+    }
+
+    bucket->count = 1;
+    bucket->first_cell_pos = new_pos;
+    table->count += 1;
+    *does_change = 1;
+    *cell_pos = new_pos;
+    return JIEBA__BUCKET_FIND_OR_ADD_CELL_SUCCESS;
+  } else {
+    size_t a_cell_pos = jieba__pos_of(bucket->first_cell_pos);
+    size_t last_cell_pos = -1;
+    for (size_t i = 0; i < bucket->count; i++) {
+      jieba__assert(
+          0 <= a_cell_pos &&
+          a_cell_pos <=
+            data_base->space_counts.cells
+      );
+
+      if (jieba__cell_key_equals(
+            word, word_size, packed, hash, &cells[a_cell_pos], characterp
+          )
+      ) {
+        *does_change = 0;
+        *cell_pos = a_cell_pos;
+        return JIEBA__BUCKET_FIND_OR_ADD_CELL_SUCCESS;
+      }
+
+      last_cell_pos = a_cell_pos;
+      a_cell_pos = jieba__pos_of(cells[a_cell_pos].next_cell_pos);
+    }
+
+    jieba__assert(a_cell_pos == (size_t)-1);
+
+    if (bucket->count == table->max_cell_per_bucket) {
+      jieba__log(
+          "hash table %p bucket %p is fill"
+          ", try extending or increase bucket size\n",
+          table, bucket
+      );
+      if (tried_times == 0)
+        return JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NEED_EXTEND;
+      else
+        table->max_cell_per_bucket += 1;
+    }
+
+    size_t new_pos = jieba__allocate_hash_table_cell(data_base);
+    if (new_pos == (size_t)-1) return JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NOMEM;
+
+    cells[new_pos].hash = hash;
+    int res = jieba__init_cell_key(
+        word, word_size, packed, data_base, &cells[new_pos]
+    );
+    if (res != 0) {
+      jieba__free_hash_table_cell(new_pos, data_base);
+      return JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NOMEM;
+    }
+
+    bucket->count += 1;
+    cells[last_cell_pos].next_cell_pos = new_pos;
+    table->count += 1;
+    *does_change = 1;
+    *cell_pos = new_pos;
+    return JIEBA__BUCKET_FIND_OR_ADD_CELL_SUCCESS;
+  }
+}
+#endif
+
+static enum jieba_add_word_result
+jieba__hash_table_find_or_add_cell(
+    const jieba__key_unit *word, size_t word_size, const uint64_t *packed,
+    jieba__cell_hash hash, struct jieba__data_base *data_base,
+    struct jieba__hash_table *table, int *does_change, size_t *cell_pos
+) {
+  if (jieba__ensure_hash_table_has_node(table, data_base) != 0)
+    return JIEBA_ADD_WORD_FAIL_NOMEM;
+
+#if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_SWISS
+  return jieba__swiss_find_or_add_cell(
+      word, word_size, packed, hash, data_base, table, does_change, cell_pos
+  );
+#elif JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CUCKOO
+  return jieba__cuckoo_find_or_add_cell(
+      word, word_size, packed, hash, data_base, table, does_change, cell_pos
+  );
+#else
+  size_t tried_times = 0;
+  int need_extend = 0;
+
+  while (1) {
+    enum jieba__bucket_find_or_add_cell_result res;
+    res = jieba__bucket_find_or_add_cell(
+        word, word_size, packed, hash, data_base, tried_times, table,
+        jieba__hash_table_bucket_of(hash, table, data_base->hash_table_nodes),
+        data_base->characterp, data_base->hash_table_cells, does_change,
+        cell_pos
+    );
+    switch (res) {
+    case JIEBA__BUCKET_FIND_OR_ADD_CELL_SUCCESS:
+      return JIEBA_ADD_WORD_SUCCESS;
+    case JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NEED_EXTEND:
+      need_extend = 1;
+      break;
+    case JIEBA__BUCKET_FIND_OR_ADD_CELL_FAIL_NOMEM:
+      return JIEBA_ADD_WORD_FAIL_NOMEM;
+    }
+
+    tried_times += 1;
+    jieba__assert(tried_times <= 1);
+
+    /* a table that could not grow takes a longer bucket instead */
+    if (need_extend)
+      jieba__hash_table_extend(table, data_base, data_base->hash_table_nodes);
+  }
+#endif
+}
+#endif
+
+#if JIEBA_DOUBLE_ARRAY_TRIE
+/* the check of a unit, a unit not cleared yet is free */
+static uint32_t jieba__trie_check(
+    size_t pos, const struct jieba__data_base *data_base
+) {
+  return pos < data_base->trie_unit_frontier
+    ? data_base->trie_units[pos].check : 0;
+}
+
+static size_t jieba__trie_child_count(
+    size_t state, struct jieba__trie_unit *units, struct jieba__trie_link *links
+) {
+  uint32_t base = units[state].base;
+  size_t count = 0;
+  for (uint32_t c = links[state].child; c != 0;
+       c = links[JIEBA__TRIE_POS(base, c)].sibling)
+    count += 1;
+  return count;
+}
+
+/*
+ * Finds a base for the children of `state`, plus a child of code
+ * `extra_code` if it is not 0, so that every child falls on a free unit.
+ * After JIEBA_TRIE_FIND_BASE_TRIALS free units are tried, the children are
+ * put beyond the frontier.
+ */
+static size_t jieba__trie_find_base(
+    size_t state, uint32_t extra_code, struct jieba__data_base *data_base
+) {
+  struct jieba__trie_unit *units = data_base->trie_units;
+  struct jieba__trie_link *links = data_base->trie_links;
+  size_t count = data_base->trie_unit_count;
+  uint32_t old_base = units[state].base;
+  uint32_t first_code = extra_code != 0 ? extra_code : links[state].child;
+  uint32_t min_code = first_code, max_code = first_code;
+
+  jieba__assert(first_code != 0);
+
+  size_t trials = 0;
+  for (size_t pos = data_base->trie_unit_first_free;
+       pos != 0 && trials < JIEBA_TRIE_FIND_BASE_TRIALS;
+       pos = links[pos].child, trials++) {
+    uint32_t base = (pos - first_code) & JIEBA__TRIE_BASE_MASK;
+    int fits = 1;
+    if (extra_code != 0) {
+      size_t p = JIEBA__TRIE_POS(base, extra_code);
+      if (p >= count || jieba__trie_check(p, data_base) != 0) continue;
+    }
+    for (uint32_t c = links[state].child; c != 0;
+         c = links[JIEBA__TRIE_POS(old_base, c)].sibling) {
+      size_t p = JIEBA__TRIE_POS(base, c);
+      if (p >= count || jieba__trie_check(p, data_base) != 0) {
+        fits = 0;
+        break;
+      }
+    }
+    if (fits) return base;
+  }
+
+  for (uint32_t c = links[state].child; c != 0;
+       c = links[JIEBA__TRIE_POS(old_base, c)].sibling) {
+    if (c < min_code) min_code = c;
+    if (c > max_code) max_code = c;
+  }
+  if (data_base->trie_unit_frontier + (max_code - min_code) >= count)
+    return (size_t)-1;
+  return (data_base->trie_unit_frontier - min_code) & JIEBA__TRIE_BASE_MASK;
+}
+
+static void jieba__trie_occupy(
+    size_t pos, uint32_t check, struct jieba__data_base *data_base
+) {
+  struct jieba__trie_link *links = data_base->trie_links;
+
+  jieba__assert(jieba__trie_check(pos, data_base) == 0);
+
+  /* units skipped by the frontier become free units below it */
+  while (data_base->trie_unit_frontier <= pos) {
+    size_t skipped = data_base->trie_unit_frontier++;
+    size_t next = data_base->trie_unit_first_free;
+    data_base->trie_units[skipped].base = 0;
+    data_base->trie_units[skipped].check = 0;
+    links[skipped].child = next;
+    links[skipped].sibling = 0;
+    if (next != 0) links[next].sibling = skipped;
+    data_base->trie_unit_first_free = skipped;
+  }
+
+  size_t next = links[pos].child, prev = links[pos].sibling;
+  if (prev == 0) data_base->trie_unit_first_free = next;
+  else links[prev].child = next;
+  if (next != 0) links[next].sibling = prev;
+
+  data_base->trie_units[pos].check = check;
+}
+
+static void jieba__trie_release(
+    size_t pos, struct jieba__data_base *data_base
+) {
+  struct jieba__trie_link *links = data_base->trie_links;
+  size_t next = data_base->trie_unit_first_free;
+
+  data_base->trie_units[pos].base = 0;
+  data_base->trie_units[pos].check = 0;
+
+  links[pos].child = next;
+  links[pos].sibling = 0;
+  if (next != 0) links[next].sibling = pos;
+  data_base->trie_unit_first_free = pos;
+}
+
+/*
+ * Moves all children of `state` so that a child of `extra_code` could be
+ * added. `*tracked` is updated if the state it refers to is moved.
+ */
+static int jieba__trie_relocate(
+    size_t state, uint32_t extra_code, size_t *tracked,
+    struct jieba__data_base *data_base
+) {
+  struct jieba__trie_unit *units = data_base->trie_units;
+  struct jieba__trie_link *links = data_base->trie_links;
+
+  size_t new_base = jieba__trie_find_base(state, extra_code, data_base);
+  if (new_base == (size_t)-1) {
+    jieba__log("trie relocating fail since no enough trie units\n");
+    return -1;
+  }
+
+  uint32_t old_base = units[state].base;
+  uint32_t c = links[state].child;
+  while (c != 0) {
+    size_t old_pos = JIEBA__TRIE_POS(old_base, c);
+    size_t new_pos = JIEBA__TRIE_POS(new_base, c);
+
+    jieba__trie_occupy(new_pos, state, data_base);
+    units[new_pos].base = units[old_pos].base;
+    links[new_pos] = links[old_pos];
+
+    uint32_t child_base = units[old_pos].base;
+    for (uint32_t g = links[old_pos].child; g != 0;
+         g = links[JIEBA__TRIE_POS(child_base, g)].sibling)
+      units[JIEBA__TRIE_POS(child_base, g)].check = new_pos;
+
+    if (*tracked == old_pos) *tracked = new_pos;
+    c = links[old_pos].sibling;
+    jieba__trie_release(old_pos, data_base);
+  }
+
+  units[state].base =
+    (units[state].base & JIEBA__TRIE_TERMINAL) | (uint32_t)new_base;
+  return 0;
+}
+
+/* gives the child of `state` through `code`, add it if there is not */
+static size_t jieba__trie_find_or_add_child(
+    size_t state, uint32_t code, struct jieba__data_base *data_base
+) {
+  struct jieba__trie_unit *units = data_base->trie_units;
+  struct jieba__trie_link *links = data_base->trie_links;
+  size_t count = data_base->trie_unit_count;
+
+  if (links[state].child == 0) {
+    size_t base = jieba__trie_find_base(state, code, data_base);
+    if (base == (size_t)-1) return (size_t)-1;
+    units[state].base =
+      (units[state].base & JIEBA__TRIE_TERMINAL) | (uint32_t)base;
+  } else {
+    size_t pos = JIEBA__TRIE_POS(units[state].base, code);
+    uint32_t check = jieba__trie_check(pos, data_base);
+    if (pos < count && check == state) return pos;
+    if (pos >= count || check != 0) {
+      /* move the one with less children away, 0 and the root never move */
+      size_t owner = pos < count ? check : (uint32_t)-1;
+      if (owner != (uint32_t)-1 &&
+          jieba__trie_child_count(owner, units, links) <=
+            jieba__trie_child_count(state, units, links)
+      ) {
+        if (jieba__trie_relocate(owner, 0, &state, data_base) != 0)
+          return (size_t)-1;
+      } else {
+        if (jieba__trie_relocate(state, code, &state, data_base) != 0)
+          return (size_t)-1;
+      }
+    }
+  }
+
+  size_t pos = JIEBA__TRIE_POS(units[state].base, code);
+  jieba__assert(pos < count && jieba__trie_check(pos, data_base) == 0);
+  jieba__trie_occupy(pos, state, data_base);
+  units[pos].base = 0;
+  links[pos].child = 0;
+  links[pos].sibling = links[state].child;
+  links[state].child = code;
+  return pos;
+}
+
+static enum jieba_add_word_result
+jieba__trie_add_word(
+    const unsigned char *word, size_t word_size,
+    struct jieba__data_base *data_base
+) {
+  size_t state = JIEBA__TRIE_ROOT;
+  for (size_t i = 0; i < word_size; i++) {
+    state = jieba__trie_find_or_add_child(state, word[i] + 1, data_base);
+    if (state == (size_t)-1) return JIEBA_ADD_WORD_FAIL_NOMEM;
+  }
+
+  if (data_base->trie_units[state].base & JIEBA__TRIE_TERMINAL)
+    return JIEBA_ADD_WORD_FAIL_ALREADY_EXISTS;
+  data_base->trie_units[state].base |= JIEBA__TRIE_TERMINAL;
+  return JIEBA_ADD_WORD_SUCCESS;
+}
+#endif
+
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+static jieba__length_mask jieba__length_mask_get(
+    uint32_t code_point, const uint32_t *directory,
+    const struct jieba__length_mask_page *pages
+) {
+  uint32_t page = directory[code_point >> 8];
+  if (page == 0) return 0;
+  if (page == JIEBA__LENGTH_MASK_PAGE_FULL) return (jieba__length_mask)-1;
+  return pages[page - 1].masks[code_point & 0xff];
+}
+
+static void jieba__length_mask_add(
+    uint32_t code_point, size_t word_count, struct jieba__data_base *data_base
+) {
+  uint32_t *directory = data_base->length_mask_directory;
+  struct jieba__length_mask_page *pages = data_base->length_mask_pages;
+  uint32_t page = directory[code_point >> 8];
+
+  if (page == 0) {
+    if (data_base->length_mask_page_used ==
+        data_base->space_counts.length_mask_pages) {
+      jieba__log("no length mask page left for %x\n", code_point);
+      directory[code_point >> 8] = JIEBA__LENGTH_MASK_PAGE_FULL;
+      return;
+    }
+    page = ++data_base->length_mask_page_used;
+    memset(&pages[page - 1], 0, sizeof(pages[page - 1]));
+    directory[code_point >> 8] = page;
+  }
+  if (page == JIEBA__LENGTH_MASK_PAGE_FULL) return;
+
+  pages[page - 1].masks[code_point & 0xff] |=
+    (jieba__length_mask)1 << (word_count - 1);
+}
+
+#if JIEBA_WORD_INFO
+/* the word of one character should be in the masks already */
+static void jieba__length_mask_set_log_frequency(
+    uint32_t code_point, int16_t log_frequency,
+    struct jieba__data_base *data_base
+) {
+  uint32_t page = data_base->length_mask_directory[code_point >> 8];
+  if (page == JIEBA__LENGTH_MASK_PAGE_FULL) return;
+  jieba__assert(page != 0);
+  data_base->length_mask_pages[page - 1].log_frequencies[code_point & 0xff] =
+    log_frequency;
+}
+#endif
+
+/* index of the highest set bit, mask should not be 0 */
+static size_t jieba__length_mask_highest(jieba__length_mask mask) {
+  jieba__assert(mask != 0);
+#if defined(__GNUC__) || defined(__clang__)
+  if (sizeof(mask) == sizeof(unsigned int))
+    return sizeof(unsigned int) * 8 - 1 - __builtin_clz(mask);
+  return sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(mask);
+#else
+  size_t n = 0;
+  while (mask >>= 1) n++;
+  return n;
+#endif
+}
+#endif
+
+/* index of the lowest set bit, mask should not be 0 */
+static size_t jieba__length_mask_lowest(jieba__length_mask mask) {
+  jieba__assert(mask != 0);
+#if defined(__GNUC__) || defined(__clang__)
+  if (sizeof(mask) == sizeof(unsigned int))
+    return __builtin_ctz(mask);
+  return __builtin_ctzll(mask);
+#else
+  size_t n = 0;
+  while (!(mask & 1)) {
+    mask >>= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+#if JIEBA_BLOOM_FILTER && !JIEBA_DOUBLE_ARRAY_TRIE
+/*
+ * The block is picked by the high half of the hash, the bits are 9 bits
+ * slices of the hash mixed once more.
+ */
+static struct jieba__bloom_filter_block *jieba__bloom_filter_block_of(
+    uint64_t hash, struct jieba__data_base *data_base
+) {
+  uint64_t idx = ((hash >> 32) * data_base->bloom_filter_block_count) >> 32;
+  return &data_base->bloom_filter_blocks[idx];
+}
+
+static void jieba__bloom_filter_add(
+    uint64_t hash, struct jieba__data_base *data_base
+) {
+  struct jieba__bloom_filter_block *block;
+  block = jieba__bloom_filter_block_of(hash, data_base);
+  uint64_t bits = _wymix(hash, _wyp[2]);
+  for (int i = 0; i < JIEBA_BLOOM_FILTER_HASH_NUMBER; i++, bits >>= 9)
+    block->bits[(bits >> 6) & 7] |= (uint64_t)1 << (bits & 63);
+}
+
+static int jieba__bloom_filter_may_contain(
+    uint64_t hash, struct jieba__data_base *data_base
+) {
+  const struct jieba__bloom_filter_block *block;
+  block = jieba__bloom_filter_block_of(hash, data_base);
+  uint64_t bits = _wymix(hash, _wyp[2]);
+  for (int i = 0; i < JIEBA_BLOOM_FILTER_HASH_NUMBER; i++, bits >>= 9)
+    if (!(block->bits[(bits >> 6) & 7] & (uint64_t)1 << (bits & 63)))
+      return 0;
+  return 1;
+}
+#endif
+
+/* a word decoded and hashed, ready to be put in the table of its length */
+struct jieba__word_key {
+  struct jieba__utf32be c32str[JIEBA_MAX_WORD_LENGTH + 1];
+  size_t count;
+  uint64_t hash;
+  uint64_t packed[JIEBA__PACKED_KEY_INTEGERS];
+};
+
+/* a word of less than 2 characters is taken, but has a count less than 2 */
+static enum jieba_add_word_result
+jieba__key_word(
+    const unsigned char *restrict word, size_t word_size,
+    struct jieba__word_key *restrict key
+) {
+  /* one more character than a word could have is a too long word */
+  key->count = JIEBA_MAX_WORD_LENGTH + 1;
+  enum jieba__mbtoc32be_result mbtoc32be_res;
+  mbtoc32be_res = jieba__mbtoc32bestr(
+      word, word_size, key->c32str, &key->count
+  );
+  switch (mbtoc32be_res) {
+  case JIEBA__MBTOC32BE_SUCCESS:
+    break;
+  case JIEBA__MBTOC32BE_BAD_UTF8:
+    return JIEBA_ADD_WORD_BAD_UTF8;
+  case JIEBA__MBTOC32BE_NO_ENOUGH_CHARACTER:
+    return JIEBA_ADD_WORD_NO_ENOUGH_CHARACTER;
+  }
+
+  if (key->count < JIEBA__SHORTEST_WORD) return JIEBA_ADD_WORD_SUCCESS;
+  if (key->count > JIEBA_MAX_WORD_LENGTH) return JIEBA_ADD_WORD_FAIL_TOO_LONG;
+
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  /* a trie walks the bytes */
+#elif JIEBA_UTF8_KEYS && !JIEBA_INCREMENTAL_PREFIX_HASH
+  key->hash = jieba__hash(word, word_size);
+#else
+  key->hash = jieba__hash_u32bearr(key->c32str, key->count);
+#endif
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+  if (key->count <= JIEBA_PACKED_KEY_MAX_LENGTH)
+    jieba__pack_key(key->c32str, key->count, key->packed);
+#endif
+  return JIEBA_ADD_WORD_SUCCESS;
+}
+
+/* log2 of x in 1/256, linear between the powers of 2, 0 for 0 */
+static int32_t jieba__log2_fixed(uint64_t x) {
+  if (x <= 1) return 0;
+#if defined(__GNUC__) || defined(__clang__)
+  int32_t exponent = 63 - __builtin_clzll(x);
+#else
+  int32_t exponent = 0;
+  while (x >> exponent > 1) exponent++;
+#endif
+  uint64_t fraction = exponent >= 8
+    ? x >> (exponent - 8) : x << (8 - exponent);
+  return exponent * 256 + (int32_t)(fraction & 255);
+}
+
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+/* puts the word in the table of its length only, not in the filters */
+static enum jieba_add_word_result
+jieba__put_word_in_table(
+    const unsigned char *restrict word, size_t word_size,
+    const struct jieba__word_key *restrict word_key,
+    const struct jieba__word_info *info, struct jieba__hash_table *table,
+    struct jieba__data_base *restrict data_base
+) {
+  enum jieba_add_word_result res;
+#if JIEBA_UTF8_KEYS
+  const jieba__key_unit *key = word;
+  size_t key_size = word_size;
+#else
+  const jieba__key_unit *key = word_key->c32str;
+  size_t key_size = word_key->count;
+  (void)word; (void)word_size;
+#endif
+  const uint64_t *packed_key =
+    word_key->count <= JIEBA_PACKED_KEY_MAX_LENGTH ? word_key->packed : NULL;
+
+  size_t cell;
   int does_change;
   res = jieba__hash_table_find_or_add_cell(
-      c32str_cache, c32str_cache_size, hash, data_base,
-      &data_base->data_base_nodes[data_base_node_pos].table,
+      key, key_size, packed_key, word_key->hash, data_base, table,
       &does_change, &cell
   );
-  if (res != JIEBA_ADD_WORD_SUCCESS) return res;
-  if (!does_change) return JIEBA_ADD_WORD_FAIL_ALREADY_EXISTS;
+  if (res != JIEBA_ADD_WORD_SUCCESS) return res;
+  if (!does_change) return JIEBA_ADD_WORD_FAIL_ALREADY_EXISTS;
+
+#if JIEBA_WORD_INFO
+  if (info != NULL) {
+    struct jieba__word_info *word_info = &data_base->word_infos[cell];
+    *word_info = *info;
+    /* at most 32 * 256, so jieba_separate_sentence needs no log */
+    word_info->log_frequency = (int16_t)jieba__log2_fixed(info->frequency);
+    data_base->frequency_total += info->frequency;
+  } else {
+    memset(&data_base->word_infos[cell], 0, sizeof(struct jieba__word_info));
+  }
+#else
+  (void)info;
+#endif
+  return JIEBA_ADD_WORD_SUCCESS;
+}
+
+/* `info` is NULL for a word without frequency and tag */
+static enum jieba_add_word_result
+jieba__put_word(
+    const unsigned char *restrict word, size_t word_size,
+    const struct jieba__word_key *restrict word_key,
+    const struct jieba__word_info *info,
+    struct jieba__data_base *restrict data_base
+) {
+  enum jieba_add_word_result res;
+  size_t data_base_node_pos;
+  res = jieba__find_data_base_node(
+      word_key->count, data_base, &data_base_node_pos
+  );
+  if (res != JIEBA_ADD_WORD_SUCCESS) return res;
+
+  res = jieba__put_word_in_table(
+      word, word_size, word_key, info,
+      &data_base->data_base_nodes[data_base_node_pos].table, data_base
+  );
+  if (res != JIEBA_ADD_WORD_SUCCESS) return res;
+
+#if JIEBA_BLOOM_FILTER
+  jieba__bloom_filter_add(word_key->hash, data_base);
+#endif
+  jieba__length_mask_add(
+      jieba__code_point_of_u32be(word_key->c32str[0]), word_key->count,
+      data_base
+  );
+#if JIEBA_WORD_INFO
+  /* so jieba_separate_sentence never looks a character up */
+  if (word_key->count == 1 && info != NULL)
+    jieba__length_mask_set_log_frequency(
+        jieba__code_point_of_u32be(word_key->c32str[0]),
+        (int16_t)jieba__log2_fixed(info->frequency), data_base
+    );
+#endif
+
+  return JIEBA_ADD_WORD_SUCCESS;
+}
+
+/* whether the words of a length are staged, and their table not built yet */
+static int jieba__is_staged(
+    size_t length, struct jieba__data_base *data_base
+) {
+#if JIEBA_THREADS
+  return __atomic_load_n(
+      &data_base->staged_words[length].count, __ATOMIC_ACQUIRE
+  ) != 0;
+#else
+  return data_base->staged_words[length].count != 0;
+#endif
+}
+
+#if JIEBA_THREADS
+/*
+ * The root is moved by growing and copied by freezing, which a mutex must
+ * not be, so the lock is one for all data bases.
+ */
+static pthread_mutex_t jieba__staging_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+ * Builds the table of a length from its staged words. Only one table is
+ * built at a time, and a table being built is not looked up by any other
+ * thread, so the other tables could still be looked up meanwhile. If the
+ * memory runs out, the words stay staged and are not built again until the
+ * data base grows, the words already put are skipped then, and a failed
+ * build is known without taking the lock.
+ */
+static enum jieba_add_word_result jieba__build_staged(
+    size_t length, struct jieba__data_base *data_base
+) {
+  struct jieba__staged_words *staged = &data_base->staged_words[length];
+#if JIEBA_THREADS
+  if (__atomic_load_n(&staged->failed, __ATOMIC_ACQUIRE))
+    return JIEBA_ADD_WORD_FAIL_NOMEM;
+  pthread_mutex_lock(&jieba__staging_lock);
+#else
+  if (staged->failed) return JIEBA_ADD_WORD_FAIL_NOMEM;
+#endif
+  enum jieba_add_word_result res = JIEBA_ADD_WORD_SUCCESS;
+  if (staged->failed) {
+    res = JIEBA_ADD_WORD_FAIL_NOMEM;
+  } else if (staged->count != 0) {
+    jieba__log("building %zu staged words of %zu\n", staged->count, length);
+    size_t node_pos;
+    res = jieba__find_data_base_node(length, data_base, &node_pos);
+    if (res == JIEBA_ADD_WORD_SUCCESS) {
+      struct jieba__hash_table *table =
+        &data_base->data_base_nodes[node_pos].table;
+      jieba__hash_table_reserve(table, table->count + staged->count, data_base);
+      /* the nodes left are counted for other lengths, so none is taken */
+      size_t first_free = data_base->hash_table_node_first_free;
+      data_base->hash_table_node_first_free = (size_t)-1;
+
+      const unsigned char *first = data_base->staging + staged->at;
+      const unsigned char *word = first + staged->put;
+      const unsigned char *end = first + staged->size;
+      while (word < end) {
+        size_t word_size = 0;
+        for (size_t b = 0; b < JIEBA__STAGED_SIZE_BYTES; b++)
+          word_size |= (size_t)word[b] << 8 * b;
+        const unsigned char *bytes = word + JIEBA__STAGED_SIZE_BYTES;
+        struct jieba__word_key key;
+        jieba__key_word(bytes, word_size, &key);
+        res = jieba__put_word_in_table(
+            bytes, word_size, &key, NULL, table, data_base
+        );
+        if (res == JIEBA_ADD_WORD_FAIL_ALREADY_EXISTS)
+          res = JIEBA_ADD_WORD_SUCCESS;
+        if (res != JIEBA_ADD_WORD_SUCCESS) break;
+        word = bytes + word_size;
+      }
+      staged->put = word - first;
+      data_base->hash_table_node_first_free = first_free;
+    }
+
+    /* only words added besides the staged ones could take their room */
+    if (res != JIEBA_ADD_WORD_SUCCESS) {
+      jieba__log("building staged words of %zu fail\n", length);
+#if JIEBA_THREADS
+      __atomic_store_n(&staged->failed, 1, __ATOMIC_RELEASE);
+#else
+      staged->failed = 1;
+#endif
+    } else {
+      staged->limit = 0;
+      data_base->staged_lengths -= 1;
+#if JIEBA_THREADS
+      __atomic_store_n(&staged->count, 0, __ATOMIC_RELEASE);
+#else
+      staged->count = 0;
+#endif
+    }
+  }
+#if JIEBA_THREADS
+  pthread_mutex_unlock(&jieba__staging_lock);
+#endif
+  return res;
+}
+
+static enum jieba_add_word_result
+jieba__build_all_staged(struct jieba__data_base *data_base) {
+  if (data_base->staged_lengths == 0) return JIEBA_ADD_WORD_SUCCESS;
+  for (size_t i = JIEBA__SHORTEST_WORD; i <= JIEBA_MAX_WORD_LENGTH; i++) {
+    enum jieba_add_word_result res = jieba__build_staged(i, data_base);
+    if (res != JIEBA_ADD_WORD_SUCCESS) return res;
+  }
+  return JIEBA_ADD_WORD_SUCCESS;
+}
+
+/*
+ * Whether a word is one of the staged words of its length not put in the
+ * table yet, one by one.
+ */
+static int jieba__find_staged(
+    const struct jieba__utf32be *c32str, size_t count,
+    struct jieba__data_base *data_base
+) {
+  const struct jieba__staged_words *staged = &data_base->staged_words[count];
+  const unsigned char *first = data_base->staging + staged->at;
+  const unsigned char *word = first + staged->put;
+  const unsigned char *end = first + staged->size;
+  while (word < end) {
+    size_t word_size = 0;
+    for (size_t b = 0; b < JIEBA__STAGED_SIZE_BYTES; b++)
+      word_size |= (size_t)*word++ << 8 * b;
+    struct jieba__utf32be staged_c32str[JIEBA_MAX_WORD_LENGTH];
+    size_t staged_count = JIEBA_MAX_WORD_LENGTH;
+    jieba__mbtoc32bestr(word, word_size, staged_c32str, &staged_count);
+    if (memcmp(staged_c32str, c32str, sizeof(*c32str) * count) == 0)
+      return 1;
+    word += word_size;
+  }
+  return 0;
+}
+#endif
+
+void jieba_set_allocator(
+    struct jieba_data_base *data_base, const struct jieba_allocator *allocator
+) {
+  if (allocator == NULL || data_base->root->frozen)
+    memset(&data_base->allocator, 0, sizeof(data_base->allocator));
+  else
+    data_base->allocator = *allocator;
+}
+
+/*
+ * Grows every part that could run out to twice as many plus what an empty
+ * data base retains. The memory may move, so the parts are found again by
+ * their offsets, and they are moved from the last one, since every part only
+ * moves forwards. Returns 0 on success.
+ */
+static int jieba__grow(struct jieba_data_base *data_base) {
+  struct jieba_allocator *allocator = &data_base->allocator;
+  struct jieba__data_base *root = data_base->root;
+  if (allocator->grow == NULL || root->frozen) return -1;
+
+  struct jieba__space_counts counts = root->space_counts, more;
+  jieba__estimate_space_counts(0, &more);
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  counts.trie_units = counts.trie_units * 2 + more.trie_units;
+  if (counts.trie_units > JIEBA__TRIE_BASE_MASK) return -1;
+#else
+  counts.characters = counts.characters * 2 + more.characters;
+  counts.cells = counts.cells * 2 + more.cells;
+  counts.hash_table_nodes = counts.hash_table_nodes * 2 + more.hash_table_nodes;
+  counts.length_mask_pages =
+    counts.length_mask_pages * 2 + more.length_mask_pages;
+  if (counts.length_mask_pages > JIEBA__LENGTH_MASK_DIRECTORY_COUNT)
+    counts.length_mask_pages = JIEBA__LENGTH_MASK_DIRECTORY_COUNT;
+  if (counts.length_mask_pages < root->space_counts.length_mask_pages)
+    counts.length_mask_pages = root->space_counts.length_mask_pages;
+  /* words failing to be built from the staging space keep it */
+  if (root->staged_lengths == 0) counts.staged_bytes = 0;
+# if JIEBA_COMPACT_LAYOUT
+  if (counts.cells >= UINT32_MAX || counts.characters >= UINT32_MAX)
+    return -1;
+# endif
+#endif
+  size_t size = jieba__space_size(&counts);
+
+  char *memory = data_base->whole_memory;
+  struct jieba__data_base old = *root;
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  size_t links_at = (char *)old.trie_links - memory;
+#else
+  size_t cells_at = (char *)old.hash_table_cells - memory;
+# if JIEBA_WORD_INFO
+  size_t infos_at = (char *)old.word_infos - memory;
+# endif
+  size_t nodes_at = (char *)old.hash_table_nodes - memory;
+  size_t data_base_nodes_at = (char *)old.data_base_nodes - memory;
+  size_t length_masks_at = (char *)old.length_mask_directory - memory;
+# if JIEBA_BLOOM_FILTER
+  size_t bloom_filter_at = (char *)old.bloom_filter_blocks - memory;
+# endif
+  size_t staging_at = (char *)old.staging - memory;
+#endif
+
+  if (size > data_base->whole_memory_size) {
+    memory = allocator->grow(
+        memory, data_base->whole_memory_size, size, allocator->context
+    );
+    if (memory == NULL) return -1;
+    data_base->whole_memory = memory;
+    data_base->whole_memory_size = size;
+    data_base->root = root = (struct jieba__data_base *)memory;
+  }
+  jieba__log("grow to %zu bytes\n", size);
+
+  size_t used = sizeof(struct jieba__data_base);
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  used += jieba__init_trie_space(&counts, memory, used, root);
+  memmove(
+      root->trie_links, memory + links_at,
+      sizeof(struct jieba__trie_link) * old.trie_unit_frontier
+  );
+#else
+  used += jieba__init_character_space(&counts, memory, used, root);
+  used += jieba__init_hash_table_cell_space(&counts, memory, used, root);
+  used += jieba__init_hash_table_node_space(&counts, memory, used, root);
+  used += jieba__init_data_base_node_space(memory, used, root);
+  used += jieba__init_length_mask_space(&counts, memory, used, root);
+# if JIEBA_BLOOM_FILTER
+  used += jieba__init_bloom_filter_space(&counts, memory, used, root);
+# endif
+  used += jieba__init_staging_space(&counts, memory, used, root);
+  memmove(root->staging, memory + staging_at, counts.staged_bytes);
+  root->staged_lengths = old.staged_lengths;
+  memcpy(root->staged_words, old.staged_words, sizeof(root->staged_words));
+  for (size_t i = 0; i <= JIEBA_MAX_WORD_LENGTH; i++)
+    root->staged_words[i].failed = 0;
+# if JIEBA_BLOOM_FILTER
+  memmove(
+      root->bloom_filter_blocks, memory + bloom_filter_at,
+      sizeof(struct jieba__bloom_filter_block) * old.bloom_filter_block_count
+  );
+# endif
+  memmove(
+      root->length_mask_directory, memory + length_masks_at,
+      old.length_mask_space_size
+  );
+  memmove(
+      root->data_base_nodes, memory + data_base_nodes_at,
+      old.data_base_node_space_size
+  );
+  memmove(
+      root->hash_table_nodes, memory + nodes_at,
+      sizeof(struct jieba__hash_table_node) * old.space_counts.hash_table_nodes
+  );
+  /* cells beyond the frontier were never used, and the characters stay */
+# if JIEBA_WORD_INFO
+  memmove(
+      root->word_infos, memory + infos_at,
+      sizeof(struct jieba__word_info) * old.hash_table_cell_frontier
+  );
+# endif
+  memmove(
+      root->hash_table_cells, memory + cells_at,
+      sizeof(struct jieba__hash_table_cell) * old.hash_table_cell_frontier
+  );
+
+  root->character_space_used = old.character_space_used;
+  root->packed_key_units = old.packed_key_units;
+  root->data_base_node_first_free = old.data_base_node_first_free;
+  root->length_mask_page_used = old.length_mask_page_used;
+  root->hash_table_cell_first_free = old.hash_table_cell_first_free;
+  root->hash_table_cell_frontier = old.hash_table_cell_frontier;
+
+  root->hash_table_node_first_free = old.hash_table_node_first_free;
+  jieba__free_hash_table_nodes(
+      old.space_counts.hash_table_nodes,
+      counts.hash_table_nodes - old.space_counts.hash_table_nodes, root
+  );
+#endif
+  jieba__assert(used == size);
+  root->space_counts = counts;
+  return 0;
+}
+
+/* `info` is NULL for a word without frequency and tag */
+static enum jieba_add_word_result
+jieba__add_word(
+    const unsigned char *restrict word, size_t word_size,
+    const struct jieba__word_info *info,
+    struct jieba__data_base *restrict data_base
+) {
+  jieba__log("adding %.*s\n", (int)word_size, word);
+
+  struct jieba__word_key key;
+  enum jieba_add_word_result res = jieba__key_word(word, word_size, &key);
+  if (res != JIEBA_ADD_WORD_SUCCESS || key.count < JIEBA__SHORTEST_WORD)
+    return res;
+
+  if (data_base->frozen) return JIEBA_ADD_WORD_FAIL_FROZEN;
+
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  (void)info;
+  return jieba__trie_add_word(word, word_size, data_base);
+#else
+  /* a word added after the staged ones may take the room counted for them */
+  res = jieba__build_all_staged(data_base);
+  if (res != JIEBA_ADD_WORD_SUCCESS) return res;
+  return jieba__put_word(word, word_size, &key, info, data_base);
+#endif
+}
+
+/* adds the word again after growing, as long as the memory could grow */
+static enum jieba_add_word_result
+jieba__add_word_growing(
+    const unsigned char *restrict word, size_t word_size,
+    const struct jieba__word_info *info,
+    struct jieba_data_base *restrict data_base
+) {
+  enum jieba_add_word_result res;
+  do {
+    res = jieba__add_word(word, word_size, info, data_base->root);
+  } while (res == JIEBA_ADD_WORD_FAIL_NOMEM && jieba__grow(data_base) == 0);
+  return res;
+}
+
+enum jieba_add_word_result
+jieba_add_word(
+    unsigned char *restrict word, size_t word_size,
+    struct jieba_data_base *restrict data_base
+) {
+  return jieba__add_word_growing(word, word_size, NULL, data_base);
+}
+
+enum jieba_add_word_result
+jieba_add_word_with_info(
+    const unsigned char *restrict word, size_t word_size,
+    const struct jieba_word_info *restrict info,
+    struct jieba_data_base *restrict data_base
+) {
+  struct jieba__word_info word_info;
+  word_info.frequency = info->frequency;
+  memcpy(word_info.tag, info->tag, sizeof(word_info.tag));
+  return jieba__add_word_growing(word, word_size, &word_info, data_base);
+}
+
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+/* words keyed at once before any of them is put */
+#define JIEBA__ADD_WORDS_BATCH 16
+
+/* starts loading the bucket, group or slots where a word would be put */
+static void jieba__hash_table_prefetch(
+    jieba__cell_hash hash, struct jieba__hash_table *table,
+    struct jieba__hash_table_node *nodes
+) {
+#if defined(__GNUC__) || defined(__clang__)
+  if (table->size == 0) return;
+# if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_SWISS
+  __builtin_prefetch(
+      &jieba__swiss_controls(table, nodes)[
+        jieba__fast_range32((uint32_t)hash, table->size)
+          * JIEBA__SWISS_GROUP_WIDTH
+      ]
+  );
+# elif JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CUCKOO
+  size_t first, second;
+  jieba__cuckoo_buckets_of(hash, table, &first, &second);
+  __builtin_prefetch(&jieba__cuckoo_buckets(table, nodes)[first]);
+  __builtin_prefetch(&jieba__cuckoo_buckets(table, nodes)[second]);
+# else
+  __builtin_prefetch(jieba__hash_table_bucket_of(hash, table, nodes));
+# endif
+#else
+  (void)hash; (void)table; (void)nodes;
+#endif
+}
+#endif
+
+/* characters number, by counting the bytes that start a utf 8 character */
+static size_t jieba__count_characters(
+    const unsigned char *word, size_t word_size
+) {
+  size_t count = 0;
+  for (size_t i = 0; i < word_size; i++) count += (word[i] & 0xc0) != 0x80;
+  return count;
+}
+
+/*
+ * The words are counted per length first, so every table is sized once for
+ * all its words, then they are keyed a batch at a time and put.
+ */
+static enum jieba_add_word_result
+jieba__add_words(
+    const unsigned char *const *restrict words,
+    const size_t *restrict word_sizes, size_t word_count,
+    struct jieba__data_base *restrict root, size_t *restrict failed_word
+) {
+  enum jieba_add_word_result res;
+  if (root->frozen) return JIEBA_ADD_WORD_FAIL_FROZEN;
+
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  for (size_t i = 0; i < word_count; i++) {
+    res = jieba__add_word(words[i], word_sizes[i], NULL, root);
+    if (res != JIEBA_ADD_WORD_SUCCESS &&
+        res != JIEBA_ADD_WORD_FAIL_ALREADY_EXISTS) {
+      *failed_word = i;
+      return res;
+    }
+  }
+  return JIEBA_ADD_WORD_SUCCESS;
+#else
+  res = jieba__build_all_staged(root);
+  if (res != JIEBA_ADD_WORD_SUCCESS) {
+    *failed_word = 0;
+    return res;
+  }
+  size_t counts[JIEBA_MAX_WORD_LENGTH + 1] = {0};
+  for (size_t i = 0; i < word_count; i++) {
+    size_t count = jieba__count_characters(words[i], word_sizes[i]);
+    if (count <= JIEBA_MAX_WORD_LENGTH) counts[count] += 1;
+  }
+  for (size_t i = JIEBA__SHORTEST_WORD; i <= JIEBA_MAX_WORD_LENGTH; i++) {
+    if (counts[i] == 0) continue;
+    size_t node_pos;
+    if (jieba__find_data_base_node(i, root, &node_pos)
+        != JIEBA_ADD_WORD_SUCCESS)
+      break;
+    struct jieba__hash_table *table = &root->data_base_nodes[node_pos].table;
+    jieba__hash_table_reserve(table, table->count + counts[i], root);
+  }
+
+  struct jieba__word_key keys[JIEBA__ADD_WORDS_BATCH];
+  enum jieba_add_word_result key_res[JIEBA__ADD_WORDS_BATCH];
+  for (size_t first = 0; first < word_count; first += JIEBA__ADD_WORDS_BATCH) {
+    size_t n = word_count - first;
+    if (n > JIEBA__ADD_WORDS_BATCH) n = JIEBA__ADD_WORDS_BATCH;
+
+    for (size_t i = 0; i < n; i++) {
+      key_res[i] = jieba__key_word(
+          words[first + i], word_sizes[first + i], &keys[i]
+      );
+      if (key_res[i] != JIEBA_ADD_WORD_SUCCESS ||
+          keys[i].count < JIEBA__SHORTEST_WORD)
+        continue;
+      size_t node_pos = root->length_data_base_node_pos[keys[i].count];
+      if (node_pos != (size_t)-1)
+        jieba__hash_table_prefetch(
+            keys[i].hash, &root->data_base_nodes[node_pos].table,
+            root->hash_table_nodes
+        );
+    }
+
+    for (size_t i = 0; i < n; i++) {
+      res = key_res[i];
+      if (res == JIEBA_ADD_WORD_SUCCESS &&
+          keys[i].count >= JIEBA__SHORTEST_WORD)
+        res = jieba__put_word(
+            words[first + i], word_sizes[first + i], &keys[i], NULL, root
+        );
+      if (res != JIEBA_ADD_WORD_SUCCESS &&
+          res != JIEBA_ADD_WORD_FAIL_ALREADY_EXISTS) {
+        *failed_word = first + i;
+        return res;
+      }
+    }
+  }
+  return JIEBA_ADD_WORD_SUCCESS;
+#endif
+}
+
+/* the words from the one that failed are added again after growing */
+enum jieba_add_word_result
+jieba_add_words(
+    const unsigned char *const *restrict words,
+    const size_t *restrict word_sizes, size_t word_count,
+    struct jieba_data_base *restrict data_base, size_t *restrict failed_word
+) {
+  enum jieba_add_word_result res;
+  size_t added = 0, failed = 0;
+  for (;;) {
+    res = jieba__add_words(
+        words + added, word_sizes + added, word_count - added,
+        data_base->root, &failed
+    );
+    if (res != JIEBA_ADD_WORD_FAIL_NOMEM || jieba__grow(data_base) != 0)
+      break;
+    added += failed;
+  }
+  if (res != JIEBA_ADD_WORD_SUCCESS && failed_word != NULL)
+    *failed_word = added + failed;
+  return res;
+}
+
+#if JIEBA_THREADS && !JIEBA_DOUBLE_ARRAY_TRIE
+#if JIEBA_BLOOM_FILTER
+/* the same as jieba__bloom_filter_add, for threads sharing the filter */
+static void jieba__bloom_filter_add_shared(
+    uint64_t hash, struct jieba__data_base *data_base
+) {
+  struct jieba__bloom_filter_block *block;
+  block = jieba__bloom_filter_block_of(hash, data_base);
+  uint64_t bits = _wymix(hash, _wyp[2]);
+  for (int i = 0; i < JIEBA_BLOOM_FILTER_HASH_NUMBER; i++, bits >>= 9)
+    __atomic_fetch_or(
+        &block->bits[(bits >> 6) & 7], (uint64_t)1 << (bits & 63),
+        __ATOMIC_RELAXED
+    );
+}
+#endif
+
+/* words dealt to the shards at a time, so their lists fit on the stack */
+#define JIEBA__SHARD_BLOCK 4096
+
+/*
+ * A shard is the words of some lengths, put in their tables by one thread.
+ * Its root shares every part with the data base, but has ranges of cells
+ * and characters of its own, taken from the data base before the threads
+ * start, and no free hash table nodes, the tables are sized before.
+ */
+struct jieba__shard {
+  struct jieba__data_base root;
+  const unsigned char *const *words;
+  const size_t *word_sizes;
+  const size_t *list; /* of the words of the block dealt to the shard */
+  size_t list_count;
+  const size_t *owners; /* the shard of each length */
+  size_t index;
+  size_t planned_words, planned_characters;
+  size_t failed_word; /* (size_t)-1 if no word failed */
+};
+
+/* keys and puts a batch of the words of the shard at a time */
+static void *jieba__build_shard(void *arg) {
+  struct jieba__shard *shard = arg;
+  struct jieba__data_base *root = &shard->root;
+  struct jieba__word_key keys[JIEBA__ADD_WORDS_BATCH];
+  enum jieba_add_word_result key_res[JIEBA__ADD_WORDS_BATCH];
+
+  for (size_t i = 0; i < shard->list_count; i += JIEBA__ADD_WORDS_BATCH) {
+    const size_t *batch = &shard->list[i];
+    size_t n = shard->list_count - i;
+    if (n > JIEBA__ADD_WORDS_BATCH) n = JIEBA__ADD_WORDS_BATCH;
+
+    for (size_t k = 0; k < n; k++) {
+      key_res[k] = jieba__key_word(
+          shard->words[batch[k]], shard->word_sizes[batch[k]], &keys[k]
+      );
+      /* a word counted otherwise is left to be added again after */
+      if (key_res[k] == JIEBA_ADD_WORD_SUCCESS &&
+          shard->owners[keys[k].count] != shard->index)
+        key_res[k] = JIEBA_ADD_WORD_FAIL_NOMEM;
+      if (key_res[k] != JIEBA_ADD_WORD_SUCCESS) continue;
+      size_t node_pos = root->length_data_base_node_pos[keys[k].count];
+      jieba__hash_table_prefetch(
+          keys[k].hash, &root->data_base_nodes[node_pos].table,
+          root->hash_table_nodes
+      );
+    }
+
+    for (size_t k = 0; k < n; k++) {
+      enum jieba_add_word_result res = key_res[k];
+      if (res == JIEBA_ADD_WORD_SUCCESS) {
+        size_t node_pos = root->length_data_base_node_pos[keys[k].count];
+        res = jieba__put_word_in_table(
+            shard->words[batch[k]], shard->word_sizes[batch[k]], &keys[k],
+            NULL, &root->data_base_nodes[node_pos].table, root
+        );
+#if JIEBA_BLOOM_FILTER
+        if (res == JIEBA_ADD_WORD_SUCCESS)
+          jieba__bloom_filter_add_shared(keys[k].hash, root);
+#endif
+      }
+      if (res != JIEBA_ADD_WORD_SUCCESS &&
+          res != JIEBA_ADD_WORD_FAIL_ALREADY_EXISTS) {
+        shard->failed_word = batch[k];
+        return NULL;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* the end of a range of `planned` from `start`, as far as `limit` */
+static size_t jieba__plan_range(size_t start, size_t planned, size_t limit) {
+  return limit - start < planned ? limit : start + planned;
+}
+
+/* gives the shard ranges of the cells and characters never used */
+static void jieba__plan_shard(
+    struct jieba__shard *shard, struct jieba__data_base *root
+) {
+  size_t cell_start = root->hash_table_cell_frontier;
+  size_t cell_end = jieba__plan_range(
+      cell_start, shard->planned_words, root->space_counts.cells
+  );
+  root->hash_table_cell_frontier = cell_end;
+
+  size_t start = root->character_space_used;
+  size_t end = jieba__plan_range(
+      start, shard->planned_characters, root->space_counts.characters
+  );
+  root->character_space_used = end;
+
+  shard->root = *root;
+  shard->root.hash_table_cell_first_free = (size_t)-1;
+  shard->root.hash_table_cell_frontier = cell_start;
+  shard->root.space_counts.cells = cell_end;
+  shard->root.character_space_used = start;
+  shard->root.space_counts.characters = end;
+  shard->root.packed_key_units = 0;
+  shard->root.hash_table_node_first_free = (size_t)-1;
+  shard->list_count = 0;
+  shard->failed_word = (size_t)-1;
+}
+
+/*
+ * Deals the words of a block to the lists of their shards, which are put in
+ * `list` one after another, so every word is decoded once for all shards.
+ */
+static void jieba__deal_block(
+    const unsigned char *const *words, const size_t *word_sizes,
+    size_t first, size_t end, struct jieba__shard *shards,
+    size_t shard_count, size_t *list
+) {
+  size_t owned[JIEBA__SHARD_BLOCK];
+  size_t starts[JIEBA_MAX_WORD_LENGTH + 1] = {0};
+  for (size_t i = first; i < end; i++) {
+    size_t count = jieba__count_characters(words[i], word_sizes[i]);
+    owned[i - first] =
+      count >= JIEBA__SHORTEST_WORD && count <= JIEBA_MAX_WORD_LENGTH
+        ? shards[0].owners[count] : (size_t)-1;
+    if (owned[i - first] != (size_t)-1) starts[owned[i - first] + 1]++;
+  }
+  for (size_t t = 0; t < shard_count; t++) {
+    starts[t + 1] += starts[t];
+    shards[t].list = &list[starts[t]];
+    shards[t].list_count = 0;
+  }
+  for (size_t i = first; i < end; i++) {
+    size_t t = owned[i - first];
+    if (t != (size_t)-1) list[starts[t] + shards[t].list_count++] = i;
+  }
+}
+
+/*
+ * Gives back what the shard has not used. Characters not used in the middle
+ * of the character space stay there, unless the shard has the last range,
+ * and so do cells, which are freed then.
+ */
+static void jieba__merge_shard(
+    struct jieba__shard *shard, struct jieba__data_base *root
+) {
+  struct jieba__data_base *shard_root = &shard->root;
+  struct jieba__hash_table_cell *cells = root->hash_table_cells;
+
+  size_t pos = shard_root->hash_table_cell_first_free;
+  if (pos != (size_t)-1) {
+    while (jieba__pos_of(cells[pos].next_cell_pos) != (size_t)-1)
+      pos = jieba__pos_of(cells[pos].next_cell_pos);
+    cells[pos].next_cell_pos = root->hash_table_cell_first_free;
+    root->hash_table_cell_first_free = shard_root->hash_table_cell_first_free;
+  }
+  if (shard_root->space_counts.cells == root->hash_table_cell_frontier) {
+    root->hash_table_cell_frontier = shard_root->hash_table_cell_frontier;
+  } else {
+    for (size_t i = shard_root->hash_table_cell_frontier;
+         i < shard_root->space_counts.cells; i++)
+      jieba__free_hash_table_cell(i, root);
+  }
+
+  if (shard_root->space_counts.characters == root->character_space_used)
+    root->character_space_used = shard_root->character_space_used;
+  root->packed_key_units += shard_root->packed_key_units;
+
+  /* a table failing to extend gives its nodes back to the shard */
+  struct jieba__hash_table_node *nodes = root->hash_table_nodes;
+  for (size_t run = shard_root->hash_table_node_first_free;
+       run != (size_t)-1;) {
+    size_t next = nodes[run].next_run_pos;
+    jieba__free_hash_table_nodes(run, nodes[run].free_count, root);
+    run = next;
+  }
+}
+#endif
+
+#if JIEBA_THREADS && !JIEBA_DOUBLE_ARRAY_TRIE
+/*
+ * The words are counted per length, every table is sized, and the lengths
+ * are dealt to the shards, the largest first to the shard having the fewest
+ * words. The words from the first one a shard fails are added again on this
+ * thread by jieba_add_words, which also grows the data base. The words are
+ * all valid.
+ */
+static enum jieba_add_word_result
+jieba__add_words_parallel(
+    const unsigned char *const *restrict words,
+    const size_t *restrict word_sizes, size_t word_count,
+    struct jieba_data_base *restrict data_base, size_t thread_count,
+    size_t *restrict failed_word
+) {
+  struct jieba__data_base *root = data_base->root;
+  if (jieba__build_all_staged(root) != JIEBA_ADD_WORD_SUCCESS)
+    return jieba_add_words(
+        words, word_sizes, word_count, data_base, failed_word
+    );
+
+  size_t counts[JIEBA_MAX_WORD_LENGTH + 1] = {0};
+  size_t units[JIEBA_MAX_WORD_LENGTH + 1] = {0};
+  size_t lengths = 0;
+  for (size_t i = 0; i < word_count; i++) {
+    size_t count = jieba__count_characters(words[i], word_sizes[i]);
+    if (count < JIEBA__SHORTEST_WORD || count > JIEBA_MAX_WORD_LENGTH) continue;
+    lengths += counts[count]++ == 0;
+
+    /* the length masks are shared by all lengths, so they are set here */
+    struct jieba__utf32be ch;
+    size_t cvt_len;
+    if (jieba__mbtoc32be(words[i], word_sizes[i], &ch, &cvt_len)
+        == JIEBA__MBTOC32BE_SUCCESS)
+      jieba__length_mask_add(jieba__code_point_of_u32be(ch), count, root);
+
+    if (count <= JIEBA_PACKED_KEY_MAX_LENGTH) continue;
+#if JIEBA_UTF8_KEYS
+    units[count] += word_sizes[i];
+#else
+    units[count] += count;
+#endif
+  }
+  if (thread_count > lengths) thread_count = lengths;
+  if (thread_count < 2)
+    return jieba_add_words(
+        words, word_sizes, word_count, data_base, failed_word
+    );
+
+  for (size_t i = JIEBA__SHORTEST_WORD; i <= JIEBA_MAX_WORD_LENGTH; i++) {
+    if (counts[i] == 0) continue;
+    size_t node_pos;
+    if (jieba__find_data_base_node(i, root, &node_pos)
+        != JIEBA_ADD_WORD_SUCCESS)
+      return jieba_add_words(
+          words, word_sizes, word_count, data_base, failed_word
+      );
+    struct jieba__hash_table *table = &root->data_base_nodes[node_pos].table;
+    jieba__hash_table_reserve(table, table->count + counts[i], root);
+  }
+
+  struct jieba__shard shards[JIEBA_MAX_WORD_LENGTH];
+  size_t owners[JIEBA_MAX_WORD_LENGTH + 1];
+  for (size_t t = 0; t < thread_count; t++) {
+    shards[t].words = words;
+    shards[t].word_sizes = word_sizes;
+    shards[t].owners = owners;
+    shards[t].index = t;
+    shards[t].planned_words = shards[t].planned_characters = 0;
+  }
+  for (size_t i = 0; i <= JIEBA_MAX_WORD_LENGTH; i++) owners[i] = (size_t)-1;
+  for (size_t n = 0; n < lengths; n++) {
+    size_t largest = 0, fewest = 0;
+    for (size_t i = JIEBA__SHORTEST_WORD; i <= JIEBA_MAX_WORD_LENGTH; i++)
+      if (owners[i] == (size_t)-1 && counts[i] > counts[largest])
+        largest = i;
+    for (size_t t = 1; t < thread_count; t++)
+      if (shards[t].planned_words < shards[fewest].planned_words) fewest = t;
+    owners[largest] = fewest;
+    shards[fewest].planned_words += counts[largest];
+    shards[fewest].planned_characters += units[largest];
+  }
+  for (size_t t = 0; t < thread_count; t++) jieba__plan_shard(&shards[t], root);
+
+  /*
+   * The threads are started for every block, and a thread not created
+   * leaves its shard to this thread. No block is built after a word fails.
+   */
+  size_t list[JIEBA__SHARD_BLOCK];
+  size_t failed = (size_t)-1;
+  for (size_t first = 0; first < word_count && failed == (size_t)-1;
+       first += JIEBA__SHARD_BLOCK) {
+    size_t end = jieba__plan_range(first, JIEBA__SHARD_BLOCK, word_count);
+    jieba__deal_block(
+        words, word_sizes, first, end, shards, thread_count, list
+    );
+    pthread_t threads[JIEBA_MAX_WORD_LENGTH];
+    int created[JIEBA_MAX_WORD_LENGTH];
+    for (size_t t = 1; t < thread_count; t++)
+      created[t] = pthread_create(
+          &threads[t], NULL, jieba__build_shard, &shards[t]
+      ) == 0;
+    jieba__build_shard(&shards[0]);
+    for (size_t t = 1; t < thread_count; t++) {
+      if (created[t]) pthread_join(threads[t], NULL);
+      else jieba__build_shard(&shards[t]);
+    }
+    for (size_t t = 0; t < thread_count; t++)
+      if (shards[t].failed_word < failed) failed = shards[t].failed_word;
+  }
+
+  for (size_t t = thread_count; t-- > 0;) jieba__merge_shard(&shards[t], root);
+  if (failed == (size_t)-1) return JIEBA_ADD_WORD_SUCCESS;
+
+  size_t again_failed = 0;
+  enum jieba_add_word_result res = jieba_add_words(
+      words + failed, word_sizes + failed, word_count - failed, data_base,
+      &again_failed
+  );
+  if (res != JIEBA_ADD_WORD_SUCCESS && failed_word != NULL)
+    *failed_word = failed + again_failed;
+  return res;
+}
+#endif
+
+/*
+ * Every word is checked before the sharding, so a bad word fails as it does
+ * for jieba_add_words, with the words before it added.
+ */
+enum jieba_add_word_result
+jieba_add_words_parallel(
+    const unsigned char *const *restrict words,
+    const size_t *restrict word_sizes, size_t word_count,
+    struct jieba_data_base *restrict data_base, size_t thread_count,
+    size_t *restrict failed_word
+) {
+#if JIEBA_THREADS && !JIEBA_DOUBLE_ARRAY_TRIE
+  if (data_base->root->frozen) return JIEBA_ADD_WORD_FAIL_FROZEN;
+
+  enum jieba_add_word_result bad_res = JIEBA_ADD_WORD_SUCCESS;
+  size_t valid = 0;
+  for (; valid < word_count; valid++) {
+    struct jieba__utf32be c32str[JIEBA_MAX_WORD_LENGTH + 1];
+    size_t count = JIEBA_MAX_WORD_LENGTH + 1;
+    switch (jieba__mbtoc32bestr(
+        words[valid], word_sizes[valid], c32str, &count
+    )) {
+    case JIEBA__MBTOC32BE_SUCCESS:
+      if (count > JIEBA_MAX_WORD_LENGTH)
+        bad_res = JIEBA_ADD_WORD_FAIL_TOO_LONG;
+      break;
+    case JIEBA__MBTOC32BE_BAD_UTF8:
+      bad_res = JIEBA_ADD_WORD_BAD_UTF8;
+      break;
+    case JIEBA__MBTOC32BE_NO_ENOUGH_CHARACTER:
+      bad_res = JIEBA_ADD_WORD_NO_ENOUGH_CHARACTER;
+      break;
+    }
+    if (bad_res != JIEBA_ADD_WORD_SUCCESS) break;
+  }
+
+  enum jieba_add_word_result res = jieba__add_words_parallel(
+      words, word_sizes, valid, data_base, thread_count, failed_word
+  );
+  if (res == JIEBA_ADD_WORD_SUCCESS && bad_res != JIEBA_ADD_WORD_SUCCESS) {
+    if (failed_word != NULL) *failed_word = valid;
+    res = bad_res;
+  }
+  return res;
+#else
+  (void)thread_count;
+  return jieba_add_words(words, word_sizes, word_count, data_base, failed_word);
+#endif
+}
+
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+static size_t jieba__popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcountll(x);
+#else
+  size_t n = 0;
+  for (; x != 0; x &= x - 1) n++;
+  return n;
+#endif
+}
+#endif
+
+void jieba_count_words(
+    const unsigned char *const *restrict words,
+    const size_t *restrict word_sizes, size_t word_count,
+    struct jieba_word_counts *restrict counts
+) {
+  for (size_t i = 0; i < word_count; i++) {
+    size_t count = jieba__count_characters(words[i], word_sizes[i]);
+    if (count < JIEBA__SHORTEST_WORD || count > JIEBA_MAX_WORD_LENGTH) continue;
+    counts->words[count] += 1;
+    counts->bytes[count] += word_sizes[i];
+
+    struct jieba__utf32be ch;
+    size_t cvt_len;
+    if (jieba__mbtoc32be(words[i], word_sizes[i], &ch, &cvt_len)
+        != JIEBA__MBTOC32BE_SUCCESS)
+      continue;
+    uint32_t page = jieba__code_point_of_u32be(ch) >> 8;
+    counts->first_character_pages[page / 8] |= 1 << page % 8;
+  }
+}
+
+/*
+ * Every word takes a cell, and the words too long to be packed their key
+ * units, every table takes the nodes it is sized to. The trie is the only
+ * thing still estimated, from the characters of the words.
+ */
+static void jieba__exact_space_counts(
+    const struct jieba_word_counts *word_counts,
+    struct jieba__space_counts *counts, size_t *total_words
+) {
+  memset(counts, 0, sizeof(*counts));
+  size_t words = 0, characters = 0;
+  for (size_t i = JIEBA__SHORTEST_WORD; i <= JIEBA_MAX_WORD_LENGTH; i++) {
+    words += word_counts->words[i];
+    characters += word_counts->words[i] * i;
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+    if (word_counts->words[i] == 0) continue;
+    counts->hash_table_nodes +=
+      jieba__hash_table_node_number(word_counts->words[i]);
+    if (i <= JIEBA_PACKED_KEY_MAX_LENGTH) continue;
+# if JIEBA_UTF8_KEYS
+    counts->characters += word_counts->bytes[i];
+# else
+    counts->characters += word_counts->words[i] * i;
+# endif
+#endif
+  }
+  *total_words = words;
+
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  counts->trie_units =
+    characters * JIEBA_ESTIMATED_TRIE_UNIT_COUNT_COEFFICIENT;
+  /* the children of a state may spread as wide as the alphabet */
+  counts->trie_units += 257;
+#else
+  counts->cells = words;
+
+  size_t pages = 0;
+  for (size_t i = 0; i < sizeof(word_counts->first_character_pages); i++)
+    pages += jieba__popcount64(word_counts->first_character_pages[i]);
+  counts->length_mask_pages = pages != 0 ? pages : JIEBA_LENGTH_MASK_PAGE_COUNT;
+
+# if JIEBA_BLOOM_FILTER
+  counts->bloom_filter_blocks =
+    (words * JIEBA_BLOOM_FILTER_BITS_PER_WORD + 511) / 512;
+  if (counts->bloom_filter_blocks == 0) counts->bloom_filter_blocks = 1;
+# endif
+#endif
+}
+
+size_t jieba_exact_memory_size(const struct jieba_word_counts *word_counts) {
+  struct jieba__space_counts counts;
+  size_t total_words;
+  jieba__exact_space_counts(word_counts, &counts, &total_words);
+  return jieba__space_size(&counts);
+}
+
+/* the tables are sized for their words here, so they never grow */
+enum jieba_init_result
+jieba_init_data_base_exactly(
+    struct jieba_data_base *restrict data_base, void *restrict whole_memory,
+    size_t whole_memory_size, const struct jieba_word_counts *word_counts,
+    size_t *required
+) {
+  struct jieba__space_counts counts;
+  size_t total_words;
+  jieba__exact_space_counts(word_counts, &counts, &total_words);
+  enum jieba_init_result res = jieba__init_data_base(
+      data_base, whole_memory, whole_memory_size, total_words, &counts,
+      required
+  );
+  if (res != JIEBA_INIT_SUCCESS) return res;
+
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+  struct jieba__data_base *root = data_base->root;
+  for (size_t i = JIEBA__SHORTEST_WORD; i <= JIEBA_MAX_WORD_LENGTH; i++) {
+    if (word_counts->words[i] == 0) continue;
+    size_t node_pos;
+    enum jieba_add_word_result add_res;
+    add_res = jieba__find_data_base_node(i, root, &node_pos);
+    jieba__assert(add_res == JIEBA_ADD_WORD_SUCCESS);
+    (void)add_res;
+    struct jieba__hash_table *table = &root->data_base_nodes[node_pos].table;
+    jieba__hash_table_reserve(table, word_counts->words[i], root);
+    jieba__assert(table->size != 0);
+  }
+#endif
+  return JIEBA_INIT_SUCCESS;
+}
+
+/* the bytes of the staged words of each length, each after its size */
+static size_t jieba__staged_bytes(
+    const struct jieba_word_counts *word_counts
+) {
+  size_t bytes = 0;
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+  for (size_t i = JIEBA__SHORTEST_WORD; i <= JIEBA_MAX_WORD_LENGTH; i++)
+    bytes +=
+      word_counts->bytes[i] + word_counts->words[i] * JIEBA__STAGED_SIZE_BYTES;
+#else
+  (void)word_counts;
+#endif
+  return bytes;
+}
+
+size_t jieba_lazy_memory_size(const struct jieba_word_counts *word_counts) {
+  return jieba_exact_memory_size(word_counts)
+    + jieba__staged_bytes(word_counts);
+}
+
+/* the tables are left empty, and built from the staged words on first use */
+enum jieba_init_result
+jieba_init_data_base_lazily(
+    struct jieba_data_base *restrict data_base, void *restrict whole_memory,
+    size_t whole_memory_size, const struct jieba_word_counts *word_counts,
+    size_t *required
+) {
+  struct jieba__space_counts counts;
+  size_t total_words;
+  jieba__exact_space_counts(word_counts, &counts, &total_words);
+  counts.staged_bytes = jieba__staged_bytes(word_counts);
+  enum jieba_init_result res = jieba__init_data_base(
+      data_base, whole_memory, whole_memory_size, total_words, &counts,
+      required
+  );
+  if (res != JIEBA_INIT_SUCCESS) return res;
+
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+  struct jieba__data_base *root = data_base->root;
+  size_t at = 0;
+  for (size_t i = JIEBA__SHORTEST_WORD; i <= JIEBA_MAX_WORD_LENGTH; i++) {
+    struct jieba__staged_words *staged = &root->staged_words[i];
+    staged->at = at;
+    staged->room =
+      word_counts->bytes[i] + word_counts->words[i] * JIEBA__STAGED_SIZE_BYTES;
+    staged->limit = word_counts->words[i];
+    at += staged->room;
+  }
+#endif
+  return JIEBA_INIT_SUCCESS;
+}
 
+/*
+ * A staged word only sets the length masks and the bloom filter, and is
+ * copied to the room of its length. A word there is no room for is added.
+ */
+enum jieba_add_word_result
+jieba_stage_words(
+    const unsigned char *const *restrict words,
+    const size_t *restrict word_sizes, size_t word_count,
+    struct jieba_data_base *restrict data_base, size_t *restrict failed_word
+) {
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  return jieba_add_words(words, word_sizes, word_count, data_base, failed_word);
+#else
+  struct jieba__data_base *root = data_base->root;
+  if (root->frozen) return JIEBA_ADD_WORD_FAIL_FROZEN;
+
+  for (size_t i = 0; i < word_count; i++) {
+    struct jieba__word_key key;
+    enum jieba_add_word_result res;
+    res = jieba__key_word(words[i], word_sizes[i], &key);
+    if (res == JIEBA_ADD_WORD_SUCCESS && key.count >= JIEBA__SHORTEST_WORD) {
+      struct jieba__staged_words *staged = &root->staged_words[key.count];
+      size_t staged_size = JIEBA__STAGED_SIZE_BYTES + word_sizes[i];
+      if (staged->count < staged->limit &&
+          staged->size + staged_size <= staged->room) {
+        unsigned char *to = root->staging + staged->at + staged->size;
+        for (size_t b = 0; b < JIEBA__STAGED_SIZE_BYTES; b++)
+          *to++ = (unsigned char)(word_sizes[i] >> 8 * b);
+        memcpy(to, words[i], word_sizes[i]);
+        staged->size += staged_size;
+        if (staged->count++ == 0) root->staged_lengths += 1;
+#if JIEBA_BLOOM_FILTER
+        jieba__bloom_filter_add(key.hash, root);
+#endif
+        jieba__length_mask_add(
+            jieba__code_point_of_u32be(key.c32str[0]), key.count, root
+        );
+      } else {
+        res = jieba__add_word_growing(words[i], word_sizes[i], NULL, data_base);
+        root = data_base->root;
+      }
+    }
+    if (res != JIEBA_ADD_WORD_SUCCESS &&
+        res != JIEBA_ADD_WORD_FAIL_ALREADY_EXISTS) {
+      if (failed_word != NULL) *failed_word = i;
+      return res;
+    }
+  }
   return JIEBA_ADD_WORD_SUCCESS;
+#endif
 }
 
-enum jieba_add_word_result
-jieba_add_word(
-    unsigned char *restrict word, size_t word_size,
-    struct jieba_data_base *restrict data_base
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+/*
+ * Gives the cells of the table new positions from `number` in the order a
+ * lookup visits them, the new position of a cell is kept in its next cell
+ * position until the cells are moved.
+ */
+static size_t jieba__compact_number_cells(
+    struct jieba__hash_table *table, size_t number,
+    struct jieba__data_base *data_base
 ) {
-  return jieba__add_word(word, word_size, data_base->root);
+  struct jieba__hash_table_node *nodes = data_base->hash_table_nodes;
+  struct jieba__hash_table_cell *cells = data_base->hash_table_cells;
+#if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_SWISS
+  uint8_t *controls = jieba__swiss_controls(table, nodes);
+  jieba__pos *slots = jieba__swiss_slots(table, nodes);
+  for (size_t i = 0; i < table->size * JIEBA__SWISS_GROUP_WIDTH; i++) {
+    if (controls[i] == JIEBA__SWISS_EMPTY) continue;
+    cells[slots[i]].next_cell_pos = number;
+    slots[i] = number++;
+  }
+#elif JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CUCKOO
+  struct jieba__cuckoo_bucket *buckets = jieba__cuckoo_buckets(table, nodes);
+  for (size_t i = 0; i < table->size; i++) {
+    for (size_t j = 0; j < JIEBA__CUCKOO_SLOTS; j++) {
+      if (buckets[i].tags[j] == 0) continue;
+      cells[buckets[i].cells[j]].next_cell_pos = number;
+      buckets[i].cells[j] = number++;
+    }
+  }
+  size_t pos = table->first_stash_cell_pos;
+  if (table->stash_count != 0) table->first_stash_cell_pos = number;
+  for (size_t i = 0; i < table->stash_count; i++) {
+    size_t next = jieba__pos_of(cells[pos].next_cell_pos);
+    cells[pos].next_cell_pos = number++;
+    pos = next;
+  }
+#else
+  for (size_t i = 0; i < table->size; i++) {
+    struct jieba__hash_table_bucket *bucket = &nodes[
+      table->first_node_pos + i / JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER
+    ].buckets[i % JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER];
+    size_t pos = jieba__pos_of(bucket->first_cell_pos);
+    if (bucket->count != 0) bucket->first_cell_pos = number;
+    for (size_t j = 0; j < bucket->count; j++) {
+      size_t next = jieba__pos_of(cells[pos].next_cell_pos);
+      cells[pos].next_cell_pos = number++;
+      pos = next;
+    }
+  }
+#endif
+  return number;
 }
 
-static int jieba__hash_table_bucket_word_exists(
-    struct jieba__utf32be *word, size_t word_size, uint64_t hash,
-    struct jieba__hash_table_bucket *bucket,
+/* the cells of a list were numbered one after another */
+static void jieba__compact_link_cells(
+    struct jieba__hash_table *table, struct jieba__data_base *data_base
+) {
+  struct jieba__hash_table_cell *cells = data_base->hash_table_cells;
+#if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CUCKOO
+  size_t first = table->first_stash_cell_pos;
+  for (size_t i = 0; i + 1 < table->stash_count; i++)
+    cells[first + i].next_cell_pos = first + i + 1;
+#elif JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CHAINING
+  struct jieba__hash_table_node *nodes = data_base->hash_table_nodes;
+  for (size_t i = 0; i < table->size; i++) {
+    struct jieba__hash_table_bucket *bucket = &nodes[
+      table->first_node_pos + i / JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER
+    ].buckets[i % JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER];
+    size_t first = jieba__pos_of(bucket->first_cell_pos);
+    for (size_t j = 0; j + 1 < bucket->count; j++)
+      cells[first + j].next_cell_pos = first + j + 1;
+  }
+#else
+  (void)table; (void)cells;
+#endif
+}
+
+/*
+ * Moves the live cells, and their word infos, to the front of the cells,
+ * table by table in the order a lookup visits them. Returns the live cells
+ * number.
+ */
+static size_t jieba__compact_cells(struct jieba__data_base *data_base) {
+  struct jieba__hash_table_cell *cells = data_base->hash_table_cells;
+  size_t count = data_base->hash_table_cell_frontier;
+
+  /* a free cell is told by having no new position */
+  for (size_t pos = data_base->hash_table_cell_first_free; pos != (size_t)-1;) {
+    size_t next = jieba__pos_of(cells[pos].next_cell_pos);
+    cells[pos].next_cell_pos = -1;
+    pos = next;
+  }
+
+  size_t live = 0;
+  for (size_t i = 0; i <= JIEBA_MAX_WORD_LENGTH; i++) {
+    size_t pos = data_base->length_data_base_node_pos[i];
+    if (pos == (size_t)-1) continue;
+    struct jieba__hash_table *table = &data_base->data_base_nodes[pos].table;
+    if (table->size == 0) continue;
+    live = jieba__compact_number_cells(table, live, data_base);
+  }
+
+  /* every swap puts one cell at its new position */
+  for (size_t i = 0; i < count; i++) {
+    size_t to;
+    while ((to = jieba__pos_of(cells[i].next_cell_pos)) != (size_t)-1 &&
+           to != i) {
+      struct jieba__hash_table_cell cell = cells[to];
+      cells[to] = cells[i];
+      cells[i] = cell;
+#if JIEBA_WORD_INFO
+      struct jieba__word_info info = data_base->word_infos[to];
+      data_base->word_infos[to] = data_base->word_infos[i];
+      data_base->word_infos[i] = info;
+#endif
+    }
+  }
+
+  for (size_t i = 0; i < live; i++) cells[i].next_cell_pos = -1;
+  for (size_t i = 0; i <= JIEBA_MAX_WORD_LENGTH; i++) {
+    size_t pos = data_base->length_data_base_node_pos[i];
+    if (pos == (size_t)-1) continue;
+    struct jieba__hash_table *table = &data_base->data_base_nodes[pos].table;
+    if (table->size == 0) continue;
+    jieba__compact_link_cells(table, data_base);
+  }
+  return live;
+}
+
+/*
+ * Moves the nodes of the tables one after another to `to`, which is not after
+ * the nodes, in the order of their positions, so no node is overwritten before
+ * it is moved. Returns the nodes number of all tables.
+ */
+static size_t jieba__compact_nodes(
+    struct jieba__hash_table_node *to, struct jieba__data_base *data_base
+) {
+  size_t used = 0, from = 0;
+  for (;;) {
+    struct jieba__hash_table *next = NULL;
+    for (size_t i = 0; i <= JIEBA_MAX_WORD_LENGTH; i++) {
+      size_t pos = data_base->length_data_base_node_pos[i];
+      if (pos == (size_t)-1) continue;
+      struct jieba__hash_table *table = &data_base->data_base_nodes[pos].table;
+      if (table->node_count == 0 || table->first_node_pos < from) continue;
+      if (next == NULL || table->first_node_pos < next->first_node_pos)
+        next = table;
+    }
+    if (next == NULL) return used;
+
+    from = next->first_node_pos + 1;
+    memmove(
+        &to[used], &data_base->hash_table_nodes[next->first_node_pos],
+        sizeof(struct jieba__hash_table_node) * next->node_count
+    );
+    next->first_node_pos = used;
+    used += next->node_count;
+  }
+}
+#endif
+
+/*
+ * Each part keeps its place in the memory and only shrinks to what is used,
+ * so moving the parts in order never overwrites a part not moved yet.
+ */
+size_t jieba_compact(struct jieba_data_base *data_base) {
+  struct jieba__data_base *root = data_base->root;
+  if (root->frozen) return 0;
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+  /* the staged words are dropped, so they are kept if they could not be */
+  if (jieba__build_all_staged(root) != JIEBA_ADD_WORD_SUCCESS) return 0;
+#endif
+
+  struct jieba__space_counts counts = root->space_counts;
+  char *memory = data_base->whole_memory;
+  size_t used = sizeof(struct jieba__data_base);
+
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  /* free units below the frontier are still chained, so they stay */
+  counts.trie_units = root->trie_unit_frontier;
+  struct jieba__trie_link *links =
+    (void *)(root->trie_units + counts.trie_units);
+  memmove(
+      links, root->trie_links,
+      sizeof(struct jieba__trie_link) * counts.trie_units
+  );
+  root->trie_links = links;
+  root->trie_unit_count = counts.trie_units;
+  root->trie_space_size = jieba__trie_space_size(&counts);
+  used += root->trie_space_size;
+#else
+  /* characters are bumped, only a parallel build leaves a few holes */
+  counts.characters = root->character_space_used;
+  root->character_space_size = jieba__character_space_size(&counts);
+  used += root->character_space_size;
+
+  counts.cells = jieba__compact_cells(root);
+  struct jieba__hash_table_cell *cells = (void *)(memory + used);
+  memmove(
+      cells, root->hash_table_cells,
+      sizeof(struct jieba__hash_table_cell) * counts.cells
+  );
+#if JIEBA_WORD_INFO
+  memmove(
+      &cells[counts.cells], root->word_infos,
+      sizeof(struct jieba__word_info) * counts.cells
+  );
+  root->word_infos = (struct jieba__word_info *)&cells[counts.cells];
+#endif
+  root->hash_table_cells = cells;
+  root->hash_table_cell_first_free = (size_t)-1;
+  root->hash_table_cell_frontier = counts.cells;
+  root->hash_table_cell_space_size = jieba__hash_table_cell_space_size(&counts);
+  used += root->hash_table_cell_space_size;
+
+  struct jieba__hash_table_node *nodes = (void *)(memory + used);
+  counts.hash_table_nodes = jieba__compact_nodes(nodes, root);
+  root->hash_table_nodes = nodes;
+  root->hash_table_node_first_free = (size_t)-1;
+  root->hash_table_node_space_size = jieba__hash_table_node_space_size(&counts);
+  used += root->hash_table_node_space_size;
+
+  memmove(
+      memory + used, root->data_base_nodes, root->data_base_node_space_size
+  );
+  root->data_base_nodes = (void *)(memory + used);
+  used += root->data_base_node_space_size;
+
+  counts.length_mask_pages = root->length_mask_page_used;
+  root->length_mask_space_size = jieba__length_mask_space_size(&counts);
+  memmove(
+      memory + used, root->length_mask_directory, root->length_mask_space_size
+  );
+  root->length_mask_directory = (void *)(memory + used);
+  root->length_mask_pages = (void *)
+    (root->length_mask_directory + JIEBA__LENGTH_MASK_DIRECTORY_COUNT);
+  used += root->length_mask_space_size;
+
+#if JIEBA_BLOOM_FILTER
+  uintptr_t blocks = (uintptr_t)(memory + used);
+  blocks += (size_t)-blocks % sizeof(struct jieba__bloom_filter_block);
+  memmove(
+      (void *)blocks, root->bloom_filter_blocks,
+      sizeof(struct jieba__bloom_filter_block) * counts.bloom_filter_blocks
+  );
+  root->bloom_filter_blocks = (struct jieba__bloom_filter_block *)blocks;
+  used += root->bloom_filter_space_size;
+#endif
+
+  counts.staged_bytes = 0;
+  root->staging_space_size = 0;
+#endif
+  jieba__assert(used == jieba__space_size(&counts));
+
+  jieba__log(
+      "compacted to %zu bytes of %zu\n", used, data_base->whole_memory_size
+  );
+  root->space_counts = counts;
+  size_t released = data_base->whole_memory_size - used;
+  data_base->whole_memory_size = used;
+  if (data_base->allocator.release != NULL && released != 0)
+    data_base->allocator.release(
+        memory + used, released, data_base->allocator.context
+    );
+  return released;
+}
+
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+#if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CHAINING
+static size_t jieba__hash_table_bucket_find_word(
+    const jieba__key_unit *word, size_t word_size, const uint64_t *packed,
+    jieba__cell_hash hash, struct jieba__hash_table_bucket *bucket,
     struct jieba__hash_table_cell *cells,
-    struct jieba__utf32be *characterp, struct jieba__data_base *data_base
+    jieba__key_unit *characterp, struct jieba__data_base *data_base
 ) {
   size_t bucket_count = bucket->count;
-  size_t cell_pos = bucket->first_cell_pos;
+  size_t cell_pos = jieba__pos_of(bucket->first_cell_pos);
   for (size_t i = 0; i < bucket_count; i++) {
-    if (cells[cell_pos].hash == hash &&
-        !memcmp(
-          word,
-          &characterp[cells[cell_pos].string.first_character_pos],
-          sizeof(struct jieba__utf32be) * word_size
+    if (jieba__cell_key_equals(
+          word, word_size, packed, hash, &cells[cell_pos], characterp
         )
     )
-      return 1;
-    cell_pos = cells[cell_pos].next_cell_pos;
+      return cell_pos;
+    cell_pos = jieba__pos_of(cells[cell_pos].next_cell_pos);
   }
   jieba__assert(cell_pos == (size_t)-1);
-  return 0;
+  return (size_t)-1;
 }
+#endif
 
-static int jieba__hash_table_word_exists(
-    struct jieba__utf32be *word, size_t word_size, uint64_t hash,
-    struct jieba__data_base *data_base, struct jieba__hash_table *table,
-    struct jieba__hash_table_node *nodes
+/* returns the cell of the word, or -1 */
+static size_t jieba__hash_table_find_word(
+    const jieba__key_unit *word, size_t word_size, const uint64_t *packed,
+    jieba__cell_hash hash, struct jieba__data_base *data_base,
+    struct jieba__hash_table *table, struct jieba__hash_table_node *nodes
 ) {
-  size_t idx = hash % table->size;
-  size_t node_idx = idx / JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER;
-  size_t bucket_idx = idx % JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER;
-
-  size_t node_pos = table->first_node_pos;
-  jieba__assert(
-      0 <= node_pos &&
-      node_pos <=
-        jieba__hash_table_node_space_count(data_base->estimated_word_count)
+  /* a table whose nodes could not be allocated has no words */
+  if (table->size == 0) return (size_t)-1;
+#if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_SWISS
+  size_t cell_pos;
+  jieba__swiss_probe(
+      word, word_size, packed, hash, table, data_base, &cell_pos
   );
-
-  while (node_idx--) {
-    node_pos = nodes[node_pos].next_node_pos;
-    jieba__assert(
-        0 <= node_pos &&
-        node_pos <=
-          jieba__hash_table_node_space_count(data_base->estimated_word_count)
-    );
-  }
-
-  return jieba__hash_table_bucket_word_exists(
-      word, word_size, hash, &nodes[node_pos].buckets[bucket_idx],
+  return cell_pos;
+#elif JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CUCKOO
+  return jieba__cuckoo_find(word, word_size, packed, hash, table, data_base);
+#else
+  return jieba__hash_table_bucket_find_word(
+      word, word_size, packed, hash,
+      jieba__hash_table_bucket_of(hash, table, nodes),
       data_base->hash_table_cells, data_base->characterp, data_base
   );
+#endif
 }
+#endif
 
+#if !JIEBA_UTF8_KEYS && !JIEBA_DOUBLE_ARRAY_TRIE
 static size_t u8sizeofu32be(const struct jieba__utf32be ch) {
   const uint8_t *in = &ch.data[0];
   uint32_t cp =
@@ -1127,17 +4181,734 @@ static size_t u8sizeofu32be(const struct jieba__utf32be ch) {
   return 4;
 }
 
-static size_t u8sizeofu32bestr(const struct jieba__utf32be *str, size_t count) {
-  size_t res = 0;
-  for (size_t i = 0; i < count; i++) res += u8sizeofu32be(str[i]);
-  return res;
+static size_t u8sizeofu32bestr(const struct jieba__utf32be *str, size_t count) {
+  size_t res = 0;
+  for (size_t i = 0; i < count; i++) res += u8sizeofu32be(str[i]);
+  return res;
+}
+#endif
+
+static void *jieba__frozen_at(
+    const struct jieba__data_base *data_base, size_t offset
+) {
+  return (char *)data_base + offset;
+}
+
+static size_t jieba__align8(size_t size) {
+  return (size + 7) & ~(size_t)7;
+}
+
+#define JIEBA__FREEZE_MAX_BUCKET_SIZE 64
+#define JIEBA__FREEZE_SEED_TRIALS 16
+
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+static size_t jieba__frozen_bucket_of(
+    uint64_t hash, const struct jieba__frozen_table *table
+) {
+  return jieba__fast_range32(hash >> 32, table->bucket_count);
+}
+
+/* the low half picks the slot, the highest 16 bits are the fingerprint */
+static uint64_t jieba__frozen_mix(
+    uint64_t hash, uint16_t pilot,
+    const struct jieba__frozen_table *table
+) {
+  return _wymix(hash ^ table->seed, _wyp[3] ^ pilot);
+}
+
+static size_t jieba__frozen_slot_of(
+    uint64_t mixed, const struct jieba__frozen_table *table
+) {
+  return jieba__fast_range32((uint32_t)mixed, table->slot_count);
+}
+
+static uint16_t jieba__frozen_fingerprint(uint64_t mixed) {
+  return (uint16_t)(mixed >> 48);
+}
+
+/*
+ * One slot read, and one key compare if the fingerprint matches. Returns the
+ * slot of the word, or -1.
+ */
+static size_t jieba__frozen_find_word(
+    const jieba__key_unit *word, size_t word_size, uint64_t hash,
+    const struct jieba__frozen_table *table,
+    const struct jieba__data_base *data_base
+) {
+  const uint16_t *pilots = jieba__frozen_at(data_base, table->pilots);
+  const struct jieba__frozen_slot *slots =
+    jieba__frozen_at(data_base, table->slots);
+  const jieba__key_unit *keys =
+    jieba__frozen_at(data_base, data_base->frozen_keys);
+
+  uint16_t pilot = pilots[jieba__frozen_bucket_of(hash, table)];
+  uint64_t mixed = jieba__frozen_mix(hash, pilot, table);
+  size_t slot_pos = jieba__frozen_slot_of(mixed, table);
+  const struct jieba__frozen_slot *slot = &slots[slot_pos];
+  if (slot->key_size == word_size &&
+      slot->fingerprint == jieba__frozen_fingerprint(mixed) &&
+      !memcmp(&keys[slot->key_pos], word, sizeof(jieba__key_unit) * word_size))
+    return slot_pos;
+  return (size_t)-1;
+}
+
+/* a word of the table being frozen, with its key copied to the frozen one */
+struct jieba__freeze_entry {
+  uint64_t hash;
+  uint32_t key_pos;
+  uint16_t key_size;
+#if JIEBA_WORD_INFO
+  struct jieba__word_info info;
+#endif
+};
+
+static void jieba__frozen_table_size(
+    size_t word_count, struct jieba__frozen_table *table
+) {
+  table->slot_count =
+    word_count + word_count / JIEBA_FREEZE_SLOT_REDUNDANCY + 1;
+  table->bucket_count = word_count / JIEBA_FREEZE_KEYS_PER_BUCKET + 1;
+}
+
+/* the entries, the sorted entries, bucket starts, bucket order, size starts */
+static size_t jieba__freeze_scratch_size(size_t word_count) {
+  struct jieba__frozen_table table;
+  jieba__frozen_table_size(word_count, &table);
+  return sizeof(struct jieba__freeze_entry) * word_count * 2
+    + sizeof(uint32_t) * (table.bucket_count + 1)
+    + sizeof(uint32_t) * table.bucket_count
+    + sizeof(uint32_t) * (JIEBA__FREEZE_MAX_BUCKET_SIZE + 2);
+}
+
+/*
+ * Sizes of the frozen data base, and of the scratch memory behind it. The
+ * staged words are counted as if none of them were added yet, so the sizes
+ * are only exact once they are built.
+ */
+static void jieba__freeze_sizes(
+    const struct jieba__data_base *data_base, size_t *image, size_t *scratch
+) {
+  size_t key_units =
+    data_base->character_space_used + data_base->packed_key_units;
+  *scratch = 0;
+  *image = 0;
+
+  for (size_t i = 0; i <= JIEBA_MAX_WORD_LENGTH; i++) {
+    size_t pos = data_base->length_data_base_node_pos[i];
+    const struct jieba__staged_words *staged = &data_base->staged_words[i];
+    if (pos == (size_t)-1 && staged->count == 0) continue;
+    size_t word_count = staged->count;
+    if (pos != (size_t)-1)
+      word_count += data_base->data_base_nodes[pos].table.count;
+    if (staged->count != 0) {
+#if JIEBA_UTF8_KEYS
+      key_units += staged->size - staged->count * JIEBA__STAGED_SIZE_BYTES;
+#else
+      key_units += staged->count * i;
+#endif
+    }
+    struct jieba__frozen_table table;
+    jieba__frozen_table_size(word_count, &table);
+    *image += jieba__align8(sizeof(uint16_t) * table.bucket_count);
+    *image += sizeof(struct jieba__frozen_slot) * table.slot_count;
+#if JIEBA_WORD_INFO
+    *image += jieba__align8(sizeof(struct jieba__word_info) * table.slot_count);
+#endif
+    if (*scratch < jieba__freeze_scratch_size(word_count))
+      *scratch = jieba__freeze_scratch_size(word_count);
+  }
+
+  *image += jieba__align8(sizeof(struct jieba__data_base));
+  *image +=
+    jieba__align8(sizeof(uint32_t) * JIEBA__LENGTH_MASK_DIRECTORY_COUNT);
+  *image += sizeof(struct jieba__length_mask_page)
+    * data_base->length_mask_page_used;
+  *image += jieba__align8(sizeof(jieba__key_unit) * key_units);
+}
+
+/* writes the units of a packed key of `count` characters, returns the number */
+static size_t jieba__unpack_key(
+    const uint64_t *packed, size_t count, jieba__key_unit *key
+) {
+  size_t used = 0;
+  for (size_t i = 0; i < count; i++) {
+    size_t n = i / JIEBA__PACKED_KEY_PER_INTEGER;
+    size_t in_integer = count - n * JIEBA__PACKED_KEY_PER_INTEGER;
+    if (in_integer > JIEBA__PACKED_KEY_PER_INTEGER)
+      in_integer = JIEBA__PACKED_KEY_PER_INTEGER;
+    size_t shift = JIEBA__PACKED_KEY_BITS
+      * (in_integer - 1 - i % JIEBA__PACKED_KEY_PER_INTEGER);
+    uint32_t cp =
+      packed[n] >> shift & (((uint32_t)1 << JIEBA__PACKED_KEY_BITS) - 1);
+#if JIEBA_UTF8_KEYS
+    if (cp <= 0x7F) {
+      key[used++] = cp;
+    } else if (cp <= 0x7FF) {
+      key[used++] = 0xC0 | cp >> 6;
+      key[used++] = 0x80 | (cp & 0x3F);
+    } else if (cp <= 0xFFFF) {
+      key[used++] = 0xE0 | cp >> 12;
+      key[used++] = 0x80 | (cp >> 6 & 0x3F);
+      key[used++] = 0x80 | (cp & 0x3F);
+    } else {
+      key[used++] = 0xF0 | cp >> 18;
+      key[used++] = 0x80 | (cp >> 12 & 0x3F);
+      key[used++] = 0x80 | (cp >> 6 & 0x3F);
+      key[used++] = 0x80 | (cp & 0x3F);
+    }
+#else
+    uint8_t *out = key[used++].data;
+    out[0]=cp>>24; out[1]=cp>>16; out[2]=cp>>8; out[3]=cp;
+#endif
+  }
+  return used;
+}
+
+static void jieba__freeze_add_entry(
+    size_t cell_pos, size_t count, const struct jieba__data_base *data_base,
+    jieba__key_unit *keys, size_t *keys_used,
+    struct jieba__freeze_entry *entries, size_t *entry_count
+) {
+  const struct jieba__hash_table_cell *cell =
+    &data_base->hash_table_cells[cell_pos];
+  size_t key_size;
+  if (count <= JIEBA_PACKED_KEY_MAX_LENGTH) {
+    key_size = jieba__unpack_key(cell->key.packed, count, &keys[*keys_used]);
+  } else {
+    key_size = cell->key.string.count;
+    memcpy(
+        &keys[*keys_used],
+        &data_base->characterp[cell->key.string.first_character_pos],
+        sizeof(jieba__key_unit) * key_size
+    );
+  }
+  /* cells may keep only a part of the hash */
+  entries[*entry_count].hash = jieba__hash_key(&keys[*keys_used], key_size);
+  entries[*entry_count].key_pos = *keys_used;
+  entries[*entry_count].key_size = (uint16_t)key_size;
+#if JIEBA_WORD_INFO
+  entries[*entry_count].info = data_base->word_infos[cell_pos];
+#endif
+  *keys_used += key_size;
+  *entry_count += 1;
+}
+
+/* copies the keys of a table of `count` characters words, and lists them */
+static size_t jieba__freeze_collect_entries(
+    struct jieba__hash_table *table, size_t count,
+    const struct jieba__data_base *data_base,
+    jieba__key_unit *keys, size_t *keys_used,
+    struct jieba__freeze_entry *entries
+) {
+  size_t entry_count = 0;
+  struct jieba__hash_table_node *nodes = data_base->hash_table_nodes;
+  if (table->size == 0) return 0;
+#if JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_SWISS
+  uint8_t *controls = jieba__swiss_controls(table, nodes);
+  jieba__pos *slots = jieba__swiss_slots(table, nodes);
+  for (size_t i = 0; i < table->size * JIEBA__SWISS_GROUP_WIDTH; i++) {
+    if (controls[i] == JIEBA__SWISS_EMPTY) continue;
+    jieba__freeze_add_entry(
+        slots[i], count, data_base, keys, keys_used, entries, &entry_count
+    );
+  }
+#elif JIEBA_HASH_TABLE == JIEBA_HASH_TABLE_CUCKOO
+  struct jieba__cuckoo_bucket *buckets = jieba__cuckoo_buckets(table, nodes);
+  for (size_t i = 0; i < table->size; i++) {
+    for (size_t j = 0; j < JIEBA__CUCKOO_SLOTS; j++) {
+      if (buckets[i].tags[j] == 0) continue;
+      jieba__freeze_add_entry(
+          buckets[i].cells[j], count, data_base, keys, keys_used, entries,
+          &entry_count
+      );
+    }
+  }
+  size_t cell_pos = table->first_stash_cell_pos;
+  for (size_t i = 0; i < table->stash_count; i++) {
+    jieba__freeze_add_entry(
+        cell_pos, count, data_base, keys, keys_used, entries, &entry_count
+    );
+    cell_pos = data_base->hash_table_cells[cell_pos].next_cell_pos;
+  }
+#else
+  for (size_t n = 0; n < table->node_count; n++) {
+    struct jieba__hash_table_node *node = &nodes[table->first_node_pos + n];
+    for (size_t i = 0; i < JIEBA_HASH_TABLE_NODE_BUCKET_NUMBER; i++) {
+      size_t cell_pos = node->buckets[i].first_cell_pos;
+      for (size_t j = 0; j < node->buckets[i].count; j++) {
+        jieba__freeze_add_entry(
+            cell_pos, count, data_base, keys, keys_used, entries,
+            &entry_count
+        );
+        cell_pos = data_base->hash_table_cells[cell_pos].next_cell_pos;
+      }
+    }
+  }
+#endif
+  return entry_count;
+}
+
+/*
+ * Buckets are placed from the largest one. A pilot is searched for each
+ * bucket so that its words all fall on empty slots, and if a bucket runs out
+ * of pilots, the whole table is tried again with another seed.
+ */
+static int jieba__freeze_table(
+    const struct jieba__freeze_entry *entries, size_t entry_count,
+    struct jieba__frozen_table *table, struct jieba__data_base *frozen,
+    void *scratch
+) {
+  struct jieba__freeze_entry *sorted = (struct jieba__freeze_entry *)scratch
+    + entry_count;
+  uint32_t *bucket_starts = (uint32_t *)&sorted[entry_count];
+  uint32_t *order = &bucket_starts[table->bucket_count + 1];
+  uint32_t *size_starts = &order[table->bucket_count];
+  uint16_t *pilots = jieba__frozen_at(frozen, table->pilots);
+  struct jieba__frozen_slot *slots = jieba__frozen_at(frozen, table->slots);
+#if JIEBA_WORD_INFO
+  struct jieba__word_info *infos = jieba__frozen_at(frozen, table->infos);
+#endif
+
+  for (size_t trial = 0; trial < JIEBA__FREEZE_SEED_TRIALS; trial++) {
+    table->seed = trial * 0x9e3779b97f4a7c15ull;
+
+    /* sort the entries by their buckets */
+    memset(bucket_starts, 0, sizeof(uint32_t) * (table->bucket_count + 1));
+    for (size_t i = 0; i < entry_count; i++)
+      bucket_starts[jieba__frozen_bucket_of(entries[i].hash, table) + 1] += 1;
+    size_t max_bucket_size = 0;
+    for (size_t b = 0; b < table->bucket_count; b++) {
+      if (max_bucket_size < bucket_starts[b + 1])
+        max_bucket_size = bucket_starts[b + 1];
+      bucket_starts[b + 1] += bucket_starts[b];
+    }
+    if (max_bucket_size > JIEBA__FREEZE_MAX_BUCKET_SIZE) continue;
+    for (size_t i = 0; i < entry_count; i++) {
+      size_t b = jieba__frozen_bucket_of(entries[i].hash, table);
+      sorted[bucket_starts[b]++] = entries[i];
+    }
+    /* now bucket b spans [bucket_starts[b], bucket_starts[b + 1]) */
+    for (size_t b = table->bucket_count; b > 0; b--)
+      bucket_starts[b] = bucket_starts[b - 1];
+    bucket_starts[0] = 0;
+
+    /* sort the buckets by their sizes, the largest first */
+    memset(size_starts, 0, sizeof(uint32_t) * (max_bucket_size + 2));
+    for (size_t b = 0; b < table->bucket_count; b++)
+      size_starts[max_bucket_size - (bucket_starts[b + 1] - bucket_starts[b])
+        + 1] += 1;
+    for (size_t k = 0; k <= max_bucket_size; k++)
+      size_starts[k + 1] += size_starts[k];
+    for (size_t b = 0; b < table->bucket_count; b++)
+      order[size_starts[
+        max_bucket_size - (bucket_starts[b + 1] - bucket_starts[b])
+      ]++] = b;
+
+    for (size_t i = 0; i < table->slot_count; i++) slots[i].key_size = 0;
+    memset(pilots, 0, sizeof(uint16_t) * table->bucket_count);
+
+    int placed_all = 1;
+    for (size_t o = 0; o < table->bucket_count && placed_all; o++) {
+      size_t b = order[o];
+      const struct jieba__freeze_entry *bucket = &sorted[bucket_starts[b]];
+      size_t bucket_size = bucket_starts[b + 1] - bucket_starts[b];
+      if (bucket_size == 0) break;
+
+      size_t poses[JIEBA__FREEZE_MAX_BUCKET_SIZE];
+      uint64_t mixes[JIEBA__FREEZE_MAX_BUCKET_SIZE];
+      uint32_t pilot;
+      for (pilot = 0; pilot <= UINT16_MAX; pilot++) {
+        size_t i;
+        for (i = 0; i < bucket_size; i++) {
+          mixes[i] = jieba__frozen_mix(bucket[i].hash, pilot, table);
+          poses[i] = jieba__frozen_slot_of(mixes[i], table);
+          if (slots[poses[i]].key_size != 0) break;
+          size_t j;
+          for (j = 0; j < i && poses[j] != poses[i]; j++);
+          if (j != i) break;
+        }
+        if (i == bucket_size) break;
+      }
+      if (pilot > UINT16_MAX) {
+        placed_all = 0;
+        break;
+      }
+
+      pilots[b] = pilot;
+      for (size_t i = 0; i < bucket_size; i++) {
+        slots[poses[i]].key_pos = bucket[i].key_pos;
+        slots[poses[i]].key_size = bucket[i].key_size;
+        slots[poses[i]].fingerprint = jieba__frozen_fingerprint(mixes[i]);
+#if JIEBA_WORD_INFO
+        infos[poses[i]] = bucket[i].info;
+#endif
+      }
+    }
+    if (placed_all) return 0;
+    jieba__log("seed %zu could not make a perfect hash\n", trial);
+  }
+  return -1;
+}
+#endif
+
+size_t jieba_freeze_memory_size(const struct jieba_data_base *data_base) {
+  const struct jieba__data_base *root = data_base->root;
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  return jieba__align8(sizeof(struct jieba__data_base))
+    + sizeof(struct jieba__trie_unit) * root->trie_unit_frontier;
+#else
+  size_t image, scratch;
+  jieba__freeze_sizes(root, &image, &scratch);
+  return image + scratch;
+#endif
+}
+
+enum jieba_freeze_result
+jieba_freeze_data_base(
+    struct jieba_data_base *restrict data_base,
+    struct jieba_data_base *restrict frozen_data_base,
+    void *restrict whole_memory, size_t whole_memory_size, size_t *required
+) {
+  struct jieba__data_base *root = data_base->root;
+  if (root->frozen) return JIEBA_FREEZE_FAIL_FROZEN;
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+  /* the staged words are built first, in the memory of the data base */
+  if (jieba__build_all_staged(root) != JIEBA_ADD_WORD_SUCCESS) {
+    if (required != NULL) *required = jieba_freeze_memory_size(data_base);
+    return JIEBA_FREEZE_FAIL_NOMEM;
+  }
+#endif
+
+  size_t size = jieba_freeze_memory_size(data_base);
+  if (required != NULL) *required = size;
+  if (size > whole_memory_size) return JIEBA_FREEZE_FAIL_NOMEM;
+
+  struct jieba__data_base *frozen = whole_memory;
+  memset(frozen, 0, sizeof(struct jieba__data_base));
+  frozen->estimated_word_count = root->estimated_word_count;
+  frozen->frequency_total = root->frequency_total;
+  frozen->frozen = 1;
+  for (size_t i = 0; i <= JIEBA_MAX_WORD_LENGTH; i++)
+    frozen->length_data_base_node_pos[i] = root->length_data_base_node_pos[i];
+  size_t used = jieba__align8(sizeof(struct jieba__data_base));
+
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  /* units beyond the frontier are free */
+  frozen->trie_unit_count = root->trie_unit_frontier;
+  frozen->trie_unit_frontier = root->trie_unit_frontier;
+  frozen->frozen_trie_units = used;
+  memcpy(
+      jieba__frozen_at(frozen, used), root->trie_units,
+      sizeof(struct jieba__trie_unit) * root->trie_unit_frontier
+  );
+  used += sizeof(struct jieba__trie_unit) * root->trie_unit_frontier;
+#else
+  frozen->frozen_length_mask_directory = used;
+  memcpy(
+      jieba__frozen_at(frozen, used), root->length_mask_directory,
+      sizeof(uint32_t) * JIEBA__LENGTH_MASK_DIRECTORY_COUNT
+  );
+  used += jieba__align8(sizeof(uint32_t) * JIEBA__LENGTH_MASK_DIRECTORY_COUNT);
+
+  frozen->frozen_length_mask_pages = used;
+  frozen->length_mask_page_used = root->length_mask_page_used;
+  memcpy(
+      jieba__frozen_at(frozen, used), root->length_mask_pages,
+      sizeof(struct jieba__length_mask_page) * root->length_mask_page_used
+  );
+  used += sizeof(struct jieba__length_mask_page) * root->length_mask_page_used;
+
+  frozen->frozen_keys = used;
+  jieba__key_unit *keys = jieba__frozen_at(frozen, used);
+  size_t keys_used = 0;
+  used += jieba__align8(sizeof(jieba__key_unit) * (
+      root->character_space_used + root->packed_key_units
+  ));
+
+  size_t image, scratch_size;
+  jieba__freeze_sizes(root, &image, &scratch_size);
+  void *scratch = jieba__frozen_at(frozen, image);
+
+  for (size_t i = 0; i <= JIEBA_MAX_WORD_LENGTH; i++) {
+    size_t pos = root->length_data_base_node_pos[i];
+    if (pos == (size_t)-1) continue;
+
+    struct jieba__hash_table *source = &root->data_base_nodes[pos].table;
+    struct jieba__frozen_table *table = &frozen->frozen_tables[i];
+    jieba__frozen_table_size(source->count, table);
+    table->pilots = used;
+    used += jieba__align8(sizeof(uint16_t) * table->bucket_count);
+    table->slots = used;
+    used += sizeof(struct jieba__frozen_slot) * table->slot_count;
+#if JIEBA_WORD_INFO
+    table->infos = used;
+    used += jieba__align8(sizeof(struct jieba__word_info) * table->slot_count);
+#endif
+
+    struct jieba__freeze_entry *entries = scratch;
+    size_t entry_count = jieba__freeze_collect_entries(
+        source, i, root, keys, &keys_used, entries
+    );
+    jieba__assert(entry_count == source->count);
+
+    if (jieba__freeze_table(entries, entry_count, table, frozen, scratch) != 0)
+      return JIEBA_FREEZE_FAIL_NO_PERFECT_HASH;
+  }
+  jieba__assert(used == image);
+#endif
+
+  frozen->frozen_size = used;
+  frozen_data_base->whole_memory = whole_memory;
+  frozen_data_base->whole_memory_size = used;
+  frozen_data_base->root = frozen;
+  memset(
+      &frozen_data_base->allocator, 0, sizeof(frozen_data_base->allocator)
+  );
+  frozen_data_base->mapped = 0;
+  return JIEBA_FREEZE_SUCCESS;
+}
+
+/*
+ * A saved data base is a header followed by a frozen data base, which only
+ * refers to itself by offsets, so it could be mapped anywhere. The magic,
+ * read as an integer, also tells the byte order.
+ */
+#define JIEBA__IMAGE_MAGIC 0x314244414245494aull /* "JIEBADB1" */
+#define JIEBA__IMAGE_VERSION 3
+
+struct jieba__image_header {
+  uint64_t magic;
+  uint64_t format;
+  uint64_t size; /* of the frozen data base behind the header */
+  uint64_t checksum;
+};
+
+/* what a frozen data base depends on besides its own contents */
+static uint64_t jieba__image_format(void) {
+  return (uint64_t)JIEBA__IMAGE_VERSION << 56
+    | (uint64_t)JIEBA_MAX_WORD_LENGTH << 48
+    | (uint64_t)JIEBA_UTF8_KEYS << 42
+    | (uint64_t)JIEBA_INCREMENTAL_PREFIX_HASH << 41
+    | (uint64_t)JIEBA_WORD_INFO << 43
+    | (uint64_t)JIEBA_DOUBLE_ARRAY_TRIE << 40
+    | sizeof(struct jieba__data_base);
+}
+
+enum jieba_save_result jieba_save_data_base(
+    const struct jieba_data_base *data_base, const char *path
+) {
+  const struct jieba__data_base *root = data_base->root;
+  if (!root->frozen) return JIEBA_SAVE_FAIL_NOT_FROZEN;
+
+  struct jieba__image_header header;
+  header.magic = JIEBA__IMAGE_MAGIC;
+  header.format = jieba__image_format();
+  header.size = root->frozen_size;
+  header.checksum = jieba__hash(root, root->frozen_size);
+
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) return JIEBA_SAVE_FAIL_IO;
+  int res = fwrite(&header, sizeof(header), 1, file) == 1 &&
+    fwrite(root, root->frozen_size, 1, file) == 1;
+  if (fclose(file) != 0) res = 0;
+  return res ? JIEBA_SAVE_SUCCESS : JIEBA_SAVE_FAIL_IO;
+}
+
+/*
+ * Only the header and the root are read, so an image is still paged in on
+ * demand. The checksum is left to the loading of files.
+ */
+enum jieba_load_result jieba_load_data_base_image(
+    struct jieba_data_base *restrict data_base, const void *restrict image,
+    size_t image_size
+) {
+  const struct jieba__image_header *header = image;
+  if (image_size < sizeof(*header)) return JIEBA_LOAD_FAIL_BAD_IMAGE;
+  if (header->magic != JIEBA__IMAGE_MAGIC) return JIEBA_LOAD_FAIL_BAD_IMAGE;
+  if (header->format != jieba__image_format())
+    return JIEBA_LOAD_FAIL_INCOMPATIBLE;
+  if (header->size > image_size - sizeof(*header) ||
+      header->size < sizeof(struct jieba__data_base))
+    return JIEBA_LOAD_FAIL_BAD_IMAGE;
+
+  const struct jieba__data_base *root = (const void *)&header[1];
+  if (!root->frozen || root->frozen_size != header->size)
+    return JIEBA_LOAD_FAIL_BAD_IMAGE;
+
+  /* nothing writes to a frozen data base */
+  data_base->whole_memory = (char *)root;
+  data_base->whole_memory_size = header->size;
+  data_base->root = (struct jieba__data_base *)root;
+  memset(&data_base->allocator, 0, sizeof(data_base->allocator));
+  data_base->mapped = 0;
+  return JIEBA_LOAD_SUCCESS;
+}
+
+#if JIEBA_MMAP
+/* maps the image in the file read only, the file is closed */
+static enum jieba_load_result jieba__map_image(
+    struct jieba_data_base *restrict data_base, int fd
+) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return JIEBA_LOAD_FAIL_IO;
+  }
+  void *image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) return JIEBA_LOAD_FAIL_IO;
+
+  enum jieba_load_result res;
+  res = jieba_load_data_base_image(data_base, image, st.st_size);
+  const struct jieba__image_header *header = image;
+  if (res == JIEBA_LOAD_SUCCESS && (
+        header->size + sizeof(*header) != (size_t)st.st_size ||
+        header->checksum != jieba__hash(data_base->root, header->size)
+      )
+  )
+    res = JIEBA_LOAD_FAIL_BAD_IMAGE;
+  if (res != JIEBA_LOAD_SUCCESS) munmap(image, st.st_size);
+  else data_base->mapped = 1;
+  return res;
+}
+#endif
+
+enum jieba_load_result jieba_load_data_base(
+    struct jieba_data_base *restrict data_base, const char *restrict path
+) {
+#if JIEBA_MMAP
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return JIEBA_LOAD_FAIL_IO;
+  return jieba__map_image(data_base, fd);
+#else
+  (void)data_base; (void)path;
+  return JIEBA_LOAD_FAIL_IO;
+#endif
+}
+
+/*
+ * The segment is created only if there is none of the name, and its header
+ * is written last, so a segment still being written is a bad image.
+ */
+enum jieba_save_result jieba_save_shared_data_base(
+    const struct jieba_data_base *data_base, const char *name
+) {
+#if JIEBA_MMAP
+  const struct jieba__data_base *root = data_base->root;
+  if (!root->frozen) return JIEBA_SAVE_FAIL_NOT_FROZEN;
+
+  struct jieba__image_header header;
+  header.magic = JIEBA__IMAGE_MAGIC;
+  header.format = jieba__image_format();
+  header.size = root->frozen_size;
+  header.checksum = jieba__hash(root, root->frozen_size);
+  size_t size = sizeof(header) + root->frozen_size;
+
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    return errno == EEXIST ? JIEBA_SAVE_FAIL_EXISTS : JIEBA_SAVE_FAIL_IO;
+  void *image = MAP_FAILED;
+  if (ftruncate(fd, size) == 0)
+    image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) {
+    shm_unlink(name);
+    return JIEBA_SAVE_FAIL_IO;
+  }
+
+  memcpy((struct jieba__image_header *)image + 1, root, root->frozen_size);
+  memcpy(image, &header, sizeof(header));
+  munmap(image, size);
+  return JIEBA_SAVE_SUCCESS;
+#else
+  (void)data_base; (void)name;
+  return JIEBA_SAVE_FAIL_IO;
+#endif
+}
+
+/* only reads the segment, so it is shared by all processes as it is */
+enum jieba_load_result jieba_load_shared_data_base(
+    struct jieba_data_base *restrict data_base, const char *restrict name
+) {
+#if JIEBA_MMAP
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) return JIEBA_LOAD_FAIL_IO;
+  return jieba__map_image(data_base, fd);
+#else
+  (void)data_base; (void)name;
+  return JIEBA_LOAD_FAIL_IO;
+#endif
+}
+
+/* an image in memory is the caller's, only a mapped one is unmapped */
+void jieba_unload_data_base(struct jieba_data_base *data_base) {
+#if JIEBA_MMAP
+  if (data_base->mapped)
+    munmap(
+        data_base->whole_memory - sizeof(struct jieba__image_header),
+        data_base->whole_memory_size + sizeof(struct jieba__image_header)
+    );
+#endif
+  data_base->whole_memory = NULL;
+  data_base->whole_memory_size = 0;
+  data_base->root = NULL;
+  data_base->mapped = 0;
+}
+
+/* all words a string starts with, for jieba_separate_sentence */
+struct jieba__matches {
+  jieba__length_mask lengths; /* bit n - 1 for a word of n characters */
+  /* log2 of the frequencies in 1/256, by characters number */
+  int16_t log_frequencies[JIEBA_MAX_WORD_LENGTH + 1];
+};
+
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+#if JIEBA_INCREMENTAL_PREFIX_HASH
+/* starts loading where the words of the lengths in the mask would be */
+static void jieba__separate_prefetch(
+    jieba__length_mask mask, const uint64_t *hashes,
+    struct jieba__data_base *data_base
+) {
+#if defined(__GNUC__) || defined(__clang__)
+  for (; mask != 0; mask &= mask - 1) {
+    size_t word_count = jieba__length_mask_lowest(mask) + 1;
+    uint64_t hash = hashes[word_count - 1];
+    if (data_base->frozen) {
+      const struct jieba__frozen_table *table =
+        &data_base->frozen_tables[word_count];
+      if (table->slot_count == 0) continue;
+      const uint16_t *pilots = jieba__frozen_at(data_base, table->pilots);
+      const struct jieba__frozen_slot *slots =
+        jieba__frozen_at(data_base, table->slots);
+      uint16_t pilot = pilots[jieba__frozen_bucket_of(hash, table)];
+      uint64_t mixed = jieba__frozen_mix(hash, pilot, table);
+      __builtin_prefetch(&slots[jieba__frozen_slot_of(mixed, table)]);
+    } else {
+      if (jieba__is_staged(word_count, data_base)) continue;
+      size_t node_pos = data_base->length_data_base_node_pos[word_count];
+      if (node_pos == (size_t)-1) continue;
+      jieba__hash_table_prefetch(
+          hash, &data_base->data_base_nodes[node_pos].table,
+          data_base->hash_table_nodes
+      );
+    }
+  }
+#else
+  (void)mask; (void)hashes; (void)data_base;
+#endif
 }
+#endif
 
+/*
+ * Only the word lengths that the first character could start are probed,
+ * longest first. If `matches` is not NULL, every length is probed and the
+ * words found are kept there.
+ */
 static enum jieba_separate_result
 jieba__separate2(
     const unsigned char *str, size_t strsize, size_t *word_size,
     struct jieba__data_base *data_base,
-    struct jieba__data_base_node *nodes
+    struct jieba__data_base_node *nodes, struct jieba__matches *matches
 ) {
   struct jieba__utf32be c32strbuf[JIEBA_MAX_WORD_LENGTH];
 
@@ -1145,19 +4916,90 @@ jieba__separate2(
     *word_size = 0;
     return JIEBA_SEPARATE_SUCCESS;
   }
+  if (matches != NULL) matches->lengths = 0;
 
-  size_t first_node_pos = data_base->first_data_base_node_pos;
+  size_t first_size;
+  enum jieba__mbtoc32be_result mbtoc32be_res;
+  mbtoc32be_res = jieba__mbtoc32be(str, strsize, &c32strbuf[0], &first_size);
+  switch (mbtoc32be_res) {
+  case JIEBA__MBTOC32BE_SUCCESS:
+    break;
+  case JIEBA__MBTOC32BE_BAD_UTF8:
+    return JIEBA_SEPARATE_BAD_UTF8;
+  case JIEBA__MBTOC32BE_NO_ENOUGH_CHARACTER:
+    return JIEBA_SEPARATE_NO_ENOUGH_CHARACTER;
+  }
 
-  jieba__assert(
-      0 <= first_node_pos &&
-      first_node_pos <= jieba__data_base_node_space_count()
-  );
+  const uint32_t *directory = data_base->length_mask_directory;
+  const struct jieba__length_mask_page *pages = data_base->length_mask_pages;
+  if (data_base->frozen) {
+    directory =
+      jieba__frozen_at(data_base, data_base->frozen_length_mask_directory);
+    pages = jieba__frozen_at(data_base, data_base->frozen_length_mask_pages);
+  }
+  uint32_t code_point = jieba__code_point_of_u32be(c32strbuf[0]);
+  jieba__length_mask mask =
+    jieba__length_mask_get(code_point, directory, pages);
+
+  /*
+   * The first character alone is the word anyway, so it is only scored, with
+   * the frequency beside its mask, and looked up if its page is full.
+   */
+  uint32_t page = directory[code_point >> 8];
+  if (matches != NULL && (mask & 1) && page != JIEBA__LENGTH_MASK_PAGE_FULL) {
+    matches->lengths |= 1;
+#if JIEBA_WORD_INFO
+    matches->log_frequencies[1] =
+      pages[page - 1].log_frequencies[code_point & 0xff];
+#else
+    matches->log_frequencies[1] = 0;
+#endif
+  }
+  if (matches == NULL || page != JIEBA__LENGTH_MASK_PAGE_FULL)
+    mask &= ~(jieba__length_mask)1;
+  if (mask == 0) {
+    *word_size = first_size;
+    return JIEBA_SEPARATE_SUCCESS;
+  }
 
-  size_t max_word_size = nodes[first_node_pos].n_chinese_letter;
-  size_t c32strbuf_count = max_word_size;
-  enum jieba__mbtoc32be_result mbtoc32be_res;
+#if JIEBA_UTF8_KEYS
+  /*
+   * The input is matched as it is, only the boundaries of the characters are
+   * found, ends[i] is the bytes number of the first i + 1 characters.
+   */
+  size_t ends[JIEBA_MAX_WORD_LENGTH];
+# if JIEBA_INCREMENTAL_PREFIX_HASH
+  uint64_t hashes[JIEBA_MAX_WORD_LENGTH];
+  hashes[0] = jieba__hash_step(0, c32strbuf[0]);
+# endif
+  size_t c32strbuf_count = 1;
+  size_t last_count = jieba__length_mask_highest(mask) + 1;
+  ends[0] = first_size;
+  while (c32strbuf_count < last_count && ends[c32strbuf_count - 1] < strsize) {
+    size_t used = ends[c32strbuf_count - 1], cvt_len;
+    mbtoc32be_res = jieba__mbtoc32be(
+        &str[used], strsize - used, &c32strbuf[c32strbuf_count], &cvt_len
+    );
+    switch (mbtoc32be_res) {
+    case JIEBA__MBTOC32BE_SUCCESS:
+      break;
+    case JIEBA__MBTOC32BE_BAD_UTF8:
+      return JIEBA_SEPARATE_BAD_UTF8;
+    case JIEBA__MBTOC32BE_NO_ENOUGH_CHARACTER:
+      return JIEBA_SEPARATE_NO_ENOUGH_CHARACTER;
+    }
+    ends[c32strbuf_count] = used + cvt_len;
+# if JIEBA_INCREMENTAL_PREFIX_HASH
+    hashes[c32strbuf_count] = jieba__hash_step(
+        hashes[c32strbuf_count - 1], c32strbuf[c32strbuf_count]
+    );
+# endif
+    c32strbuf_count += 1;
+  }
+#else
+  size_t rest_count = jieba__length_mask_highest(mask);
   mbtoc32be_res = jieba__mbtoc32bestr(
-      str, strsize, c32strbuf, &c32strbuf_count
+      &str[first_size], strsize - first_size, &c32strbuf[1], &rest_count
   );
   switch (mbtoc32be_res) {
   case JIEBA__MBTOC32BE_SUCCESS:
@@ -1168,51 +5010,199 @@ jieba__separate2(
     return JIEBA_SEPARATE_NO_ENOUGH_CHARACTER;
   }
 
-  if (c32strbuf_count == 1) {
-    *word_size = 1;
-    return JIEBA_SEPARATE_SUCCESS;
+  size_t c32strbuf_count = rest_count + 1;
+# if JIEBA_INCREMENTAL_PREFIX_HASH
+  uint64_t hashes[JIEBA_MAX_WORD_LENGTH];
+  jieba__hash_u32bearr_prefixes(c32strbuf, c32strbuf_count, hashes);
+# endif
+#endif
+
+  if (c32strbuf_count < sizeof(mask) * 8)
+    mask &= ((jieba__length_mask)1 << c32strbuf_count) - 1;
+
+#if JIEBA_INCREMENTAL_PREFIX_HASH
+  /* every length is looked up, so their loads could overlap */
+  if (matches != NULL) jieba__separate_prefetch(mask, hashes, data_base);
+#endif
+
+  while (mask != 0) {
+    size_t word_count = jieba__length_mask_highest(mask) + 1;
+    mask &= ~((jieba__length_mask)1 << (word_count - 1));
+
+    /* words failing to be built are still found among the staged ones */
+    int staged = jieba__is_staged(word_count, data_base) &&
+      jieba__build_staged(word_count, data_base) != JIEBA_ADD_WORD_SUCCESS;
+
+    /* a full page admits lengths no word has */
+    size_t node_pos = data_base->length_data_base_node_pos[word_count];
+    if (data_base->frozen) {
+      if (data_base->frozen_tables[word_count].slot_count == 0) continue;
+    } else {
+      if (node_pos == (size_t)-1 && !staged) continue;
+      jieba__assert(node_pos <= jieba__data_base_node_space_count());
+    }
+
+#if JIEBA_UTF8_KEYS
+    const jieba__key_unit *key = str;
+    size_t key_size = ends[word_count - 1];
+#else
+    const jieba__key_unit *key = c32strbuf;
+    size_t key_size = word_count;
+#endif
+
+#if JIEBA_INCREMENTAL_PREFIX_HASH
+    uint64_t hash = hashes[word_count - 1];
+#elif JIEBA_UTF8_KEYS
+    uint64_t hash = jieba__hash(key, key_size);
+#else
+    uint64_t hash = jieba__hash_u32bearr(c32strbuf, word_count);
+#endif
+
+    size_t res;
+    if (data_base->frozen) {
+      res = jieba__frozen_find_word(
+          key, key_size, hash, &data_base->frozen_tables[word_count],
+          data_base
+      );
+    } else {
+#if JIEBA_BLOOM_FILTER
+      if (!jieba__bloom_filter_may_contain(hash, data_base)) continue;
+#endif
+      uint64_t packed[JIEBA__PACKED_KEY_INTEGERS], *packed_key = NULL;
+      if (word_count <= JIEBA_PACKED_KEY_MAX_LENGTH) {
+        jieba__pack_key(c32strbuf, word_count, packed);
+        packed_key = packed;
+      }
+      res = (size_t)-1;
+      if (node_pos != (size_t)-1)
+        res = jieba__hash_table_find_word(
+            key, key_size, packed_key, hash, data_base,
+            &nodes[node_pos].table, data_base->hash_table_nodes
+        );
+      if (res == (size_t)-1 && staged &&
+          jieba__find_staged(c32strbuf, word_count, data_base))
+        res = JIEBA__STAGED_POS;
+    }
+    if (res != (size_t)-1 && matches != NULL) {
+      matches->lengths |= (jieba__length_mask)1 << (word_count - 1);
+#if JIEBA_WORD_INFO
+      const struct jieba__word_info *infos = data_base->frozen
+        ? jieba__frozen_at(
+              data_base, data_base->frozen_tables[word_count].infos
+          )
+        : data_base->word_infos;
+      matches->log_frequencies[word_count] =
+        res == JIEBA__STAGED_POS ? 0 : infos[res].log_frequency;
+#else
+      matches->log_frequencies[word_count] = 0;
+#endif
+    } else if (res != (size_t)-1) {
+#if JIEBA_UTF8_KEYS
+      *word_size = key_size;
+#else
+      *word_size = u8sizeofu32bestr(c32strbuf, word_count);
+#endif
+      return JIEBA_SEPARATE_SUCCESS;
+    }
   }
 
-  size_t last_node_n_chinese_letter = (size_t)-1;
-  size_t node_pos = first_node_pos;
-  while (node_pos != (size_t)-1) {
-    jieba__assert(
-        0 <= node_pos && node_pos <= jieba__data_base_node_space_count()
-    );
+  *word_size = first_size;
+  return JIEBA_SEPARATE_SUCCESS;
+}
+#endif
+
+#if JIEBA_DOUBLE_ARRAY_TRIE
+static size_t jieba__trie_walk(
+    size_t state, const unsigned char *bytes, size_t count,
+    struct jieba__trie_unit *units, size_t unit_count
+) {
+  for (size_t i = 0; i < count; i++) {
+    size_t pos = JIEBA__TRIE_POS(units[state].base, bytes[i] + 1);
+    if (pos >= unit_count || units[pos].check != state) return (size_t)-1;
+    state = pos;
+  }
+  return state;
+}
+
+/*
+ * Walks the trie along the string, and remembers the last word end. Only the
+ * first character must be legal, a broken character is never in a word.
+ */
+static enum jieba_separate_result
+jieba__trie_separate(
+    const unsigned char *str, size_t strsize, size_t *word_size,
+    struct jieba__data_base *data_base, struct jieba__trie_unit *units,
+    struct jieba__matches *matches
+) {
+  struct jieba__utf32be ch;
+  size_t cvt_len;
+  enum jieba__mbtoc32be_result mbtoc32be_res;
 
-    size_t word_count = nodes[node_pos].n_chinese_letter;
+  if (strsize == 0) {
+    *word_size = 0;
+    return JIEBA_SEPARATE_SUCCESS;
+  }
 
-    jieba__assert(word_count < last_node_n_chinese_letter);
+  mbtoc32be_res = jieba__mbtoc32be(str, strsize, &ch, &cvt_len);
+  switch (mbtoc32be_res) {
+  case JIEBA__MBTOC32BE_SUCCESS:
+    break;
+  case JIEBA__MBTOC32BE_BAD_UTF8:
+    return JIEBA_SEPARATE_BAD_UTF8;
+  case JIEBA__MBTOC32BE_NO_ENOUGH_CHARACTER:
+    return JIEBA_SEPARATE_NO_ENOUGH_CHARACTER;
+  }
 
-    if (strsize >= word_count) {
-      uint64_t hash = jieba__hash_u32bearr(c32strbuf, word_count);
+  size_t unit_count = data_base->trie_unit_frontier;
+  size_t state = JIEBA__TRIE_ROOT;
+  size_t used = 0, longest = cvt_len;
+  if (matches != NULL) matches->lengths = 0;
 
-      int res = jieba__hash_table_word_exists(
-          c32strbuf, word_count, hash, data_base, &nodes[node_pos].table,
-          data_base->hash_table_nodes
+  for (size_t n = 0; n < JIEBA_MAX_WORD_LENGTH; n++) {
+    if (n != 0) {
+      mbtoc32be_res = jieba__mbtoc32be(
+          &str[used], strsize - used, &ch, &cvt_len
       );
-      if (res) {
-        *word_size = u8sizeofu32bestr(c32strbuf, word_count);
-        return JIEBA_SEPARATE_SUCCESS;
-      } 
+      if (mbtoc32be_res != JIEBA__MBTOC32BE_SUCCESS) break;
     }
 
-    last_node_n_chinese_letter = word_count;
-    node_pos = nodes[node_pos].next_node_pos;
+    state = jieba__trie_walk(state, &str[used], cvt_len, units, unit_count);
+    if (state == (size_t)-1) break;
+
+    used += cvt_len;
+    if (units[state].base & JIEBA__TRIE_TERMINAL) {
+      longest = used;
+      /* the trie keeps no frequency */
+      if (matches != NULL) {
+        matches->lengths |= (jieba__length_mask)1 << n;
+        matches->log_frequencies[n + 1] = 0;
+      }
+    }
   }
 
-  *word_size = u8sizeofu32bestr(c32strbuf, 1);
+  *word_size = longest;
   return JIEBA_SEPARATE_SUCCESS;
 }
+#endif
 
 static enum jieba_separate_result
 jieba__separate(
     const unsigned char *str, size_t strsize, size_t *word_size,
-    struct jieba__data_base *data_base
+    struct jieba__data_base *data_base, struct jieba__matches *matches
 ) {
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  return jieba__trie_separate(
+      str, strsize, word_size, data_base,
+      data_base->frozen
+        ? jieba__frozen_at(data_base, data_base->frozen_trie_units)
+        : data_base->trie_units,
+      matches
+  );
+#else
   return jieba__separate2(
-      str, strsize, word_size, data_base, data_base->data_base_nodes
+      str, strsize, word_size, data_base, data_base->data_base_nodes, matches
   );
+#endif
 }
 
 enum jieba_separate_result
@@ -1220,5 +5210,626 @@ jieba_separate(
     const unsigned char *str, size_t strsize, size_t *word_size,
     struct jieba_data_base *data_base
 ) {
-  return jieba__separate(str, strsize, word_size, data_base->root);
+  return jieba__separate(str, strsize, word_size, data_base->root, NULL);
+}
+
+/*
+ * The characters of the sentence are scored from the last one, the score of
+ * a character is the highest log probability of the words from it to the
+ * end, through every word it starts, or itself alone. A word of frequency
+ * f has the log probability log2(f) - log2(total), quantized to 1/256, its
+ * log2(f) is kept in its info when it is added, and a character alone, or a
+ * word of no frequency, is taken as of frequency 1.
+ */
+enum jieba_separate_result
+jieba_separate_sentence(
+    const unsigned char *restrict str, size_t strsize,
+    size_t *restrict word_sizes, size_t *restrict word_count,
+    struct jieba_data_base *restrict data_base
+) {
+  struct jieba__data_base *root = data_base->root;
+  size_t starts[JIEBA_SENTENCE_LENGTH + 1];
+  int32_t scores[JIEBA_SENTENCE_LENGTH + 1];
+  uint8_t lengths[JIEBA_SENTENCE_LENGTH];
+  struct jieba__matches matches;
+
+  /* the sentence ends before a broken character, unless it is the first */
+  size_t count = 0, used = 0;
+  while (used < strsize && count < JIEBA_SENTENCE_LENGTH) {
+    struct jieba__utf32be ch;
+    size_t cvt_len;
+    enum jieba__mbtoc32be_result mbtoc32be_res;
+    mbtoc32be_res = jieba__mbtoc32be(&str[used], strsize - used, &ch, &cvt_len);
+    if (mbtoc32be_res != JIEBA__MBTOC32BE_SUCCESS && count == 0) {
+      *word_count = 0;
+      return mbtoc32be_res == JIEBA__MBTOC32BE_BAD_UTF8
+        ? JIEBA_SEPARATE_BAD_UTF8 : JIEBA_SEPARATE_NO_ENOUGH_CHARACTER;
+    }
+    if (mbtoc32be_res != JIEBA__MBTOC32BE_SUCCESS) break;
+    starts[count++] = used;
+    used += cvt_len;
+  }
+  starts[count] = used;
+
+  int32_t total = jieba__log2_fixed(root->frequency_total);
+  scores[count] = 0;
+  for (size_t i = count; i-- > 0;) {
+    size_t word_size;
+    jieba__separate(
+        &str[starts[i]], used - starts[i], &word_size, root, &matches
+    );
+
+    /* a longer word wins a tie */
+    int32_t best = scores[i + 1] - total;
+    size_t best_length = 1;
+    for (jieba__length_mask mask = matches.lengths; mask != 0;
+         mask &= mask - 1) {
+      size_t length = jieba__length_mask_lowest(mask) + 1;
+      int32_t score =
+        scores[i + length] - total + matches.log_frequencies[length];
+      if (score >= best) {
+        best = score;
+        best_length = length;
+      }
+    }
+    scores[i] = best;
+    lengths[i] = (uint8_t)best_length;
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < count; i += lengths[i])
+    word_sizes[n++] = starts[i + lengths[i]] - starts[i];
+  /* the last word may go on beyond a sentence that is cut */
+  if (used < strsize && n > 1) n -= 1;
+  *word_count = n;
+  return JIEBA_SEPARATE_SUCCESS;
+}
+
+/* log probabilities are in 1/256 of log2, this is the lowest */
+#define JIEBA__HMM_MIN_LOG (-32767)
+/* a slot of no character */
+#define JIEBA__HMM_EMPTY ((uint32_t)-1)
+
+/* a character and its emission log probabilities by state */
+struct jieba__hmm_slot {
+  uint32_t code_point;
+  int16_t emission[JIEBA_HMM_STATE_COUNT];
+};
+
+/* the characters are kept in an open addressing table after the root */
+struct jieba__hmm {
+  int32_t start[JIEBA_HMM_STATE_COUNT];
+  int32_t transition[JIEBA_HMM_STATE_COUNT][JIEBA_HMM_STATE_COUNT];
+  size_t slot_count; /* a power of 2, at least twice the capacity */
+  size_t character_count;
+  size_t character_capacity;
+};
+
+static struct jieba__hmm_slot *jieba__hmm_slots(const struct jieba__hmm *root) {
+  return (struct jieba__hmm_slot *)
+    ((char *)root + jieba__align8(sizeof(struct jieba__hmm)));
+}
+
+static size_t jieba__hmm_slot_count(size_t character_count) {
+  size_t slot_count = 2;
+  while (slot_count < character_count * 2) slot_count *= 2;
+  return slot_count;
+}
+
+/* from a natural logarithm, as jieba gives them */
+static int16_t jieba__hmm_log(double log_probability) {
+  double x = log_probability * (256 / 0.6931471805599453);
+  if (!(x > JIEBA__HMM_MIN_LOG)) return JIEBA__HMM_MIN_LOG;
+  if (x > 0) return 0;
+  return (int16_t)(x - 0.5);
+}
+
+static size_t jieba__hmm_slot_of(
+    uint32_t code_point, const struct jieba__hmm *root
+) {
+  return (size_t)_wymix(code_point, _wyp[0]) & (root->slot_count - 1);
+}
+
+/* the emissions of the character, or NULL if it is not given */
+static const int16_t *jieba__hmm_find(
+    uint32_t code_point, const struct jieba__hmm *root
+) {
+  const struct jieba__hmm_slot *slots = jieba__hmm_slots(root);
+  size_t pos = jieba__hmm_slot_of(code_point, root);
+  while (slots[pos].code_point != JIEBA__HMM_EMPTY) {
+    if (slots[pos].code_point == code_point) return slots[pos].emission;
+    pos = (pos + 1) & (root->slot_count - 1);
+  }
+  return NULL;
+}
+
+size_t jieba_hmm_memory_size(size_t character_count) {
+  return jieba__align8(sizeof(struct jieba__hmm))
+    + sizeof(struct jieba__hmm_slot) * jieba__hmm_slot_count(character_count);
+}
+
+enum jieba_init_result
+jieba_init_hmm(
+    struct jieba_hmm *restrict hmm, void *restrict whole_memory,
+    size_t whole_memory_size, size_t character_count,
+    const double start[JIEBA_HMM_STATE_COUNT],
+    const double transition[JIEBA_HMM_STATE_COUNT][JIEBA_HMM_STATE_COUNT],
+    size_t *required
+) {
+  if (required != NULL) *required = jieba_hmm_memory_size(character_count);
+  if (jieba_hmm_memory_size(character_count) > whole_memory_size)
+    return JIEBA_INIT_FAIL_NOMEM;
+
+  struct jieba__hmm *root = whole_memory;
+  hmm->whole_memory = whole_memory;
+  hmm->whole_memory_size = whole_memory_size;
+  hmm->root = root;
+
+  for (size_t i = 0; i < JIEBA_HMM_STATE_COUNT; i++) {
+    root->start[i] = jieba__hmm_log(start[i]);
+    for (size_t j = 0; j < JIEBA_HMM_STATE_COUNT; j++)
+      root->transition[i][j] = jieba__hmm_log(transition[i][j]);
+  }
+  root->slot_count = jieba__hmm_slot_count(character_count);
+  root->character_count = 0;
+  root->character_capacity = character_count;
+
+  struct jieba__hmm_slot *slots = jieba__hmm_slots(root);
+  for (size_t i = 0; i < root->slot_count; i++)
+    slots[i].code_point = JIEBA__HMM_EMPTY;
+  return JIEBA_INIT_SUCCESS;
+}
+
+enum jieba_add_word_result
+jieba_hmm_set_emission(
+    const unsigned char *restrict character, size_t character_size,
+    enum jieba_hmm_state state, double log_probability,
+    struct jieba_hmm *restrict hmm
+) {
+  struct jieba__hmm *root = hmm->root;
+  struct jieba__utf32be ch;
+  size_t cvt_len;
+  switch (jieba__mbtoc32be(character, character_size, &ch, &cvt_len)) {
+  case JIEBA__MBTOC32BE_SUCCESS:
+    break;
+  case JIEBA__MBTOC32BE_BAD_UTF8:
+    return JIEBA_ADD_WORD_BAD_UTF8;
+  case JIEBA__MBTOC32BE_NO_ENOUGH_CHARACTER:
+    return JIEBA_ADD_WORD_NO_ENOUGH_CHARACTER;
+  }
+  if (cvt_len != character_size) return JIEBA_ADD_WORD_FAIL_TOO_LONG;
+
+  uint32_t code_point = jieba__code_point_of_u32be(ch);
+  struct jieba__hmm_slot *slots = jieba__hmm_slots(root);
+  size_t pos = jieba__hmm_slot_of(code_point, root);
+  while (slots[pos].code_point != JIEBA__HMM_EMPTY &&
+         slots[pos].code_point != code_point)
+    pos = (pos + 1) & (root->slot_count - 1);
+
+  /* the states not given yet are as low as they could be */
+  if (slots[pos].code_point == JIEBA__HMM_EMPTY) {
+    if (root->character_count == root->character_capacity)
+      return JIEBA_ADD_WORD_FAIL_NOMEM;
+    root->character_count += 1;
+    slots[pos].code_point = code_point;
+    for (size_t i = 0; i < JIEBA_HMM_STATE_COUNT; i++)
+      slots[pos].emission[i] = JIEBA__HMM_MIN_LOG;
+  }
+  slots[pos].emission[state] = jieba__hmm_log(log_probability);
+  return JIEBA_ADD_WORD_SUCCESS;
+}
+
+#if JIEBA_SSE2
+/* the 4 emissions widened to 32 bits */
+static __m128i jieba__hmm_load_emission(const int16_t *emission) {
+  __m128i e = _mm_loadl_epi64((const __m128i *)emission);
+  return _mm_srai_epi32(_mm_unpacklo_epi16(e, e), 16);
+}
+
+/* keeps the paths through state `from` that beat the best ones so far */
+static void jieba__hmm_relax(
+    __m128i candidate, int from, __m128i *best, __m128i *best_from
+) {
+  __m128i greater = _mm_cmpgt_epi32(candidate, *best);
+  *best = _mm_or_si128(
+      _mm_and_si128(greater, candidate), _mm_andnot_si128(greater, *best)
+  );
+  *best_from = _mm_or_si128(
+      _mm_and_si128(greater, _mm_set1_epi32(from)),
+      _mm_andnot_si128(greater, *best_from)
+  );
+}
+#endif
+
+/*
+ * Viterbi over the characters of the emissions given, all 4 states of a
+ * character at once. A word could not be left open, so the last state is the
+ * end or single one.
+ */
+static void jieba__hmm_viterbi(
+    const int16_t *const *emissions, size_t count,
+    const struct jieba__hmm *root, uint8_t *states
+) {
+  uint8_t froms[JIEBA_SENTENCE_LENGTH][JIEBA_HMM_STATE_COUNT];
+  int32_t scores[JIEBA_HMM_STATE_COUNT];
+
+#if JIEBA_SSE2
+  __m128i rows[JIEBA_HMM_STATE_COUNT];
+  for (size_t i = 0; i < JIEBA_HMM_STATE_COUNT; i++)
+    rows[i] = _mm_loadu_si128((const __m128i *)root->transition[i]);
+  __m128i score = _mm_add_epi32(
+      _mm_loadu_si128((const __m128i *)root->start),
+      jieba__hmm_load_emission(emissions[0])
+  );
+  for (size_t t = 1; t < count; t++) {
+    __m128i best = _mm_add_epi32(_mm_shuffle_epi32(score, 0x00), rows[0]);
+    __m128i best_from = _mm_setzero_si128();
+    jieba__hmm_relax(
+        _mm_add_epi32(_mm_shuffle_epi32(score, 0x55), rows[1]), 1,
+        &best, &best_from
+    );
+    jieba__hmm_relax(
+        _mm_add_epi32(_mm_shuffle_epi32(score, 0xaa), rows[2]), 2,
+        &best, &best_from
+    );
+    jieba__hmm_relax(
+        _mm_add_epi32(_mm_shuffle_epi32(score, 0xff), rows[3]), 3,
+        &best, &best_from
+    );
+    score = _mm_add_epi32(best, jieba__hmm_load_emission(emissions[t]));
+    best_from = _mm_packs_epi32(best_from, best_from);
+    best_from = _mm_packus_epi16(best_from, best_from);
+    uint32_t packed = (uint32_t)_mm_cvtsi128_si32(best_from);
+    memcpy(froms[t], &packed, sizeof(froms[t]));
+  }
+  _mm_storeu_si128((__m128i *)scores, score);
+#else
+  for (size_t i = 0; i < JIEBA_HMM_STATE_COUNT; i++)
+    scores[i] = root->start[i] + emissions[0][i];
+  for (size_t t = 1; t < count; t++) {
+    int32_t next[JIEBA_HMM_STATE_COUNT];
+    for (size_t to = 0; to < JIEBA_HMM_STATE_COUNT; to++) {
+      int32_t best = scores[0] + root->transition[0][to];
+      uint8_t best_from = 0;
+      for (size_t from = 1; from < JIEBA_HMM_STATE_COUNT; from++) {
+        int32_t candidate = scores[from] + root->transition[from][to];
+        if (candidate > best) {
+          best = candidate;
+          best_from = (uint8_t)from;
+        }
+      }
+      next[to] = best + emissions[t][to];
+      froms[t][to] = best_from;
+    }
+    memcpy(scores, next, sizeof(scores));
+  }
+#endif
+
+  /* froms[0] is never set, the first state has nothing before it */
+  uint8_t state = scores[JIEBA_HMM_SINGLE] >= scores[JIEBA_HMM_END]
+    ? JIEBA_HMM_SINGLE : JIEBA_HMM_END;
+  for (size_t t = count - 1; t != 0; t--) {
+    states[t] = state;
+    state = froms[t][state];
+  }
+  states[0] = state;
+}
+
+/*
+ * Puts the words of the run found by the model at word_sizes[*n]. As in
+ * jieba, a run that is a word of the data base is left in characters.
+ */
+static void jieba__hmm_join_run(
+    const unsigned char *run_str, const int16_t *const *emissions,
+    const size_t *sizes, size_t count, const struct jieba__hmm *root,
+    struct jieba_data_base *data_base, size_t *word_sizes, size_t *n
+) {
+  uint8_t states[JIEBA_SENTENCE_LENGTH];
+  size_t run_size = 0;
+  for (size_t i = 0; i < count; i++) run_size += sizes[i];
+  if (count > 1 && !jieba_find_word(run_str, run_size, data_base, NULL)) {
+    jieba__hmm_viterbi(emissions, count, root, states);
+  } else {
+    for (size_t i = 0; i < count; i++) states[i] = JIEBA_HMM_SINGLE;
+  }
+
+  size_t word_size = 0;
+  for (size_t i = 0; i < count; i++) {
+    word_size += sizes[i];
+    if (states[i] == JIEBA_HMM_END || states[i] == JIEBA_HMM_SINGLE) {
+      word_sizes[(*n)++] = word_size;
+      word_size = 0;
+    }
+  }
+}
+
+/*
+ * The words of one character are joined as they come, a run ends at a word
+ * of more characters or at a character the model does not have. A run could
+ * only give fewer words, so they are written over the ones read.
+ */
+void jieba_hmm_join_characters(
+    const unsigned char *restrict str, size_t *restrict word_sizes,
+    size_t *restrict word_count, const struct jieba_hmm *restrict hmm,
+    struct jieba_data_base *restrict data_base
+) {
+  const struct jieba__hmm *root = hmm->root;
+  const int16_t *emissions[JIEBA_SENTENCE_LENGTH];
+  size_t sizes[JIEBA_SENTENCE_LENGTH];
+  size_t run = 0, run_at = 0, n = 0, used = 0;
+
+  for (size_t i = 0; i < *word_count; i++) {
+    size_t word_size = word_sizes[i];
+    const int16_t *emission = NULL;
+    struct jieba__utf32be ch;
+    size_t cvt_len;
+    if (jieba__mbtoc32be(&str[used], word_size, &ch, &cvt_len)
+          == JIEBA__MBTOC32BE_SUCCESS && cvt_len == word_size)
+      emission = jieba__hmm_find(jieba__code_point_of_u32be(ch), root);
+
+    if (emission != NULL) {
+      if (run == 0) run_at = used;
+      emissions[run] = emission;
+      sizes[run++] = word_size;
+    }
+    used += word_size;
+    if (emission != NULL && run < JIEBA_SENTENCE_LENGTH) continue;
+
+    jieba__hmm_join_run(
+        &str[run_at], emissions, sizes, run, root, data_base, word_sizes, &n
+    );
+    run = 0;
+    if (emission == NULL) word_sizes[n++] = word_size;
+  }
+  jieba__hmm_join_run(
+      &str[run_at], emissions, sizes, run, root, data_base, word_sizes, &n
+  );
+  *word_count = n;
+}
+
+#if !JIEBA_DOUBLE_ARRAY_TRIE
+/* of a word found, but whose frequency and tag are not kept */
+static const struct jieba__word_info jieba__no_word_info;
+
+/* the cell or the frozen slot of the word, or NULL if there is no word */
+static const struct jieba__word_info *jieba__find_word_info(
+    const unsigned char *word, size_t word_size,
+    struct jieba__data_base *data_base
+) {
+  struct jieba__utf32be c32str[JIEBA_MAX_WORD_LENGTH + 1];
+  /* one more character than a word could have is a too long word */
+  size_t count = JIEBA_MAX_WORD_LENGTH + 1;
+  if (jieba__mbtoc32bestr(word, word_size, c32str, &count)
+      != JIEBA__MBTOC32BE_SUCCESS)
+    return NULL;
+  if (count < JIEBA__SHORTEST_WORD || count > JIEBA_MAX_WORD_LENGTH)
+    return NULL;
+
+#if JIEBA_UTF8_KEYS
+  const jieba__key_unit *key = word;
+  size_t key_size = word_size;
+#else
+  const jieba__key_unit *key = c32str;
+  size_t key_size = count;
+#endif
+#if JIEBA_UTF8_KEYS && !JIEBA_INCREMENTAL_PREFIX_HASH
+  uint64_t hash = jieba__hash(key, key_size);
+#else
+  uint64_t hash = jieba__hash_u32bearr(c32str, count);
+#endif
+
+  size_t pos;
+  if (data_base->frozen) {
+    const struct jieba__frozen_table *table =
+      &data_base->frozen_tables[count];
+    if (table->slot_count == 0) return NULL;
+    pos = jieba__frozen_find_word(key, key_size, hash, table, data_base);
+    if (pos == (size_t)-1) return NULL;
+#if JIEBA_WORD_INFO
+    return (const struct jieba__word_info *)jieba__frozen_at(
+        data_base, table->infos
+    ) + pos;
+#endif
+  } else {
+    /* words failing to be built are still found among the staged ones */
+    if (jieba__is_staged(count, data_base) &&
+        jieba__build_staged(count, data_base) != JIEBA_ADD_WORD_SUCCESS &&
+        jieba__find_staged(c32str, count, data_base))
+      return &jieba__no_word_info;
+    size_t node_pos = data_base->length_data_base_node_pos[count];
+    if (node_pos == (size_t)-1) return NULL;
+    uint64_t packed[JIEBA__PACKED_KEY_INTEGERS], *packed_key = NULL;
+    if (count <= JIEBA_PACKED_KEY_MAX_LENGTH) {
+      jieba__pack_key(c32str, count, packed);
+      packed_key = packed;
+    }
+    pos = jieba__hash_table_find_word(
+        key, key_size, packed_key, hash, data_base,
+        &data_base->data_base_nodes[node_pos].table,
+        data_base->hash_table_nodes
+    );
+    if (pos == (size_t)-1) return NULL;
+#if JIEBA_WORD_INFO
+    return &data_base->word_infos[pos];
+#endif
+  }
+#if !JIEBA_WORD_INFO
+  return &jieba__no_word_info;
+#endif
+}
+#endif
+
+int jieba_find_word(
+    const unsigned char *restrict word, size_t word_size,
+    struct jieba_data_base *restrict data_base,
+    struct jieba_word_info *restrict info
+) {
+  struct jieba__data_base *root = data_base->root;
+#if JIEBA_DOUBLE_ARRAY_TRIE
+  struct jieba__trie_unit *units = root->frozen
+    ? jieba__frozen_at(root, root->frozen_trie_units)
+    : root->trie_units;
+  size_t state = jieba__trie_walk(
+      JIEBA__TRIE_ROOT, word, word_size, units, root->trie_unit_frontier
+  );
+  if (state == (size_t)-1 || !(units[state].base & JIEBA__TRIE_TERMINAL))
+    return 0;
+  if (info != NULL) memset(info, 0, sizeof(*info));
+  return 1;
+#else
+  const struct jieba__word_info *found =
+    jieba__find_word_info(word, word_size, root);
+  if (found == NULL) return 0;
+  if (info != NULL) {
+    info->frequency = found->frequency;
+    memcpy(info->tag, found->tag, sizeof(info->tag));
+  }
+  return 1;
+#endif
+}
+
+static int jieba__is_separator(char c) {
+  return c == ' ' || c == '\t';
+}
+
+/* the next field of a line from *pos, its size is 0 at the end of the line */
+static size_t jieba__next_field(
+    const char *line, size_t size, size_t *pos, const char **field
+) {
+  size_t i = *pos;
+  while (i < size && jieba__is_separator(line[i])) i++;
+  *field = &line[i];
+  size_t start = i;
+  while (i < size && !jieba__is_separator(line[i])) i++;
+  *pos = i;
+  return i - start;
+}
+
+/*
+ * A line is "word [frequency] [tag]", like the dict.txt of jieba, it is
+ * parsed where it is. Returns 0 for a bad line.
+ */
+static int jieba__parse_dictionary_line(
+    const char *line, size_t size, size_t *word_size,
+    struct jieba__word_info *info
+) {
+  const char *field;
+  size_t pos = 0, field_size;
+  memset(info, 0, sizeof(*info));
+  *word_size = jieba__next_field(line, size, &pos, &field);
+
+  field_size = jieba__next_field(line, size, &pos, &field);
+  size_t digits = 0;
+  while (digits < field_size && field[digits] >= '0' && field[digits] <= '9')
+    digits++;
+  if (field_size != 0 && digits == field_size) {
+    /* a frequency too large to be kept is the largest one */
+    uint64_t frequency = 0;
+    for (size_t i = 0; i < digits; i++) {
+      frequency = frequency * 10 + (field[i] - '0');
+      if (frequency > UINT32_MAX) frequency = UINT32_MAX;
+    }
+    info->frequency = frequency;
+    field_size = jieba__next_field(line, size, &pos, &field);
+  }
+
+  if (field_size > sizeof(info->tag)) return 0;
+  memcpy(info->tag, field, field_size);
+  return jieba__next_field(line, size, &pos, &field) == 0;
+}
+
+enum jieba_load_dictionary_result
+jieba_add_dictionary(
+    const char *restrict text, size_t text_size,
+    struct jieba_data_base *restrict data_base, size_t *restrict failed_line
+) {
+  size_t line_number = 0;
+  while (text_size != 0) {
+    const char *end = memchr(text, '\n', text_size);
+    size_t size = end == NULL ? text_size : (size_t)(end - text);
+    size_t next = end == NULL ? size : size + 1;
+    line_number += 1;
+    if (size != 0 && text[size - 1] == '\r') size -= 1;
+
+    if (size != 0) {
+      size_t word_size;
+      struct jieba__word_info info;
+      if (!jieba__parse_dictionary_line(text, size, &word_size, &info)) {
+        if (failed_line != NULL) *failed_line = line_number;
+        return JIEBA_LOAD_DICTIONARY_FAIL_BAD_LINE;
+      }
+      enum jieba_add_word_result res = jieba__add_word_growing(
+          (const unsigned char *)text, word_size, &info, data_base
+      );
+      if (res != JIEBA_ADD_WORD_SUCCESS &&
+          res != JIEBA_ADD_WORD_FAIL_ALREADY_EXISTS) {
+        if (failed_line != NULL) *failed_line = line_number;
+        return JIEBA_LOAD_DICTIONARY_FAIL_ADD_WORD;
+      }
+    }
+    text += next; text_size -= next;
+  }
+  return JIEBA_LOAD_DICTIONARY_SUCCESS;
+}
+
+/* the file is mapped, not read, and parsed where it is mapped */
+enum jieba_load_dictionary_result
+jieba_load_dictionary(
+    const char *restrict path, struct jieba_data_base *restrict data_base,
+    size_t *restrict failed_line
+) {
+#if JIEBA_MMAP
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return JIEBA_LOAD_DICTIONARY_FAIL_IO;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return JIEBA_LOAD_DICTIONARY_FAIL_IO;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return JIEBA_LOAD_DICTIONARY_SUCCESS;
+  }
+  void *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (text == MAP_FAILED) return JIEBA_LOAD_DICTIONARY_FAIL_IO;
+# ifdef MADV_SEQUENTIAL
+  madvise(text, st.st_size, MADV_SEQUENTIAL);
+# endif
+
+  enum jieba_load_dictionary_result res;
+  res = jieba_add_dictionary(text, st.st_size, data_base, failed_line);
+  munmap(text, st.st_size);
+  return res;
+#else
+  (void)path; (void)data_base; (void)failed_line;
+  return JIEBA_LOAD_DICTIONARY_FAIL_IO;
+#endif
+}
+
+/*
+ * A missing word passes a block if all its bits are set there, so the rate
+ * is the mean over blocks of the set bits ratio to the power of bits per word.
+ */
+double jieba_bloom_filter_false_positive_rate(
+    const struct jieba_data_base *data_base
+) {
+#if JIEBA_BLOOM_FILTER && !JIEBA_DOUBLE_ARRAY_TRIE
+  const struct jieba__data_base *root = data_base->root;
+  if (root->frozen || root->bloom_filter_block_count == 0) return 1;
+  double sum = 0;
+  for (size_t i = 0; i < root->bloom_filter_block_count; i++) {
+    size_t set = 0;
+    for (size_t j = 0; j < 8; j++)
+      set += jieba__popcount64(root->bloom_filter_blocks[i].bits[j]);
+    double rate = 1;
+    for (int k = 0; k < JIEBA_BLOOM_FILTER_HASH_NUMBER; k++)
+      rate *= set / 512.0;
+    sum += rate;
+  }
+  return sum / root->bloom_filter_block_count;
+#else
+  (void)data_base;
+  return 1;
+#endif
 }
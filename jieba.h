@@ -2,18 +2,35 @@
 #define JIEBA_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 struct jieba__data_base;
 
+/*
+ * Lets a data base grow when it runs out of memory, instead of failing with
+ * JIEBA_ADD_WORD_FAIL_NOMEM. `grow` gives memory of `new_size` bytes that
+ * starts with the `size` bytes of `memory`, like realloc, and it may move or
+ * map them anywhere, or gives NULL if it could not. `release` is told the
+ * bytes at the end of the memory that are not used any more, it may be NULL.
+ */
+struct jieba_allocator {
+  void *(*grow)(void *memory, size_t size, size_t new_size, void *context);
+  void (*release)(void *memory, size_t size, void *context);
+  void *context;
+};
+
 struct jieba_data_base {
   char *whole_memory;
   size_t whole_memory_size;
   struct jieba__data_base *root;
+  struct jieba_allocator allocator; /* all NULL if the memory is fixed */
+  int mapped; /* 1 if loading mapped it, so unloading unmaps it */
 };
 
 enum jieba_init_result {
   JIEBA_INIT_SUCCESS,
-  JIEBA_INIT_FAIL_NOMEM
+  JIEBA_INIT_FAIL_NOMEM,
+  JIEBA_INIT_FAIL_TOO_MANY_WORDS
 };
 
 enum jieba_init_result jieba_init_data_base(
@@ -23,13 +40,63 @@ enum jieba_init_result jieba_init_data_base(
 
 size_t jieba_estimate_memory_size(size_t estimated_word_count);
 
+/* NULL takes the allocator away, a frozen data base never grows */
+void jieba_set_allocator(
+    struct jieba_data_base *data_base, const struct jieba_allocator *allocator
+);
+
+/*
+ * The words a data base is going to have, counted by their characters
+ * number, so the data base could be sized exactly for them. They are counted
+ * by jieba_count_words, which adds to the counts, or filled by hand. A page
+ * is 256 code points, all 0 means the pages are not known.
+ */
+#define JIEBA_WORD_COUNTS_LENGTHS 65
+#define JIEBA_WORD_COUNTS_PAGE_BYTES ((0x110000 >> 8) / 8)
+
+struct jieba_word_counts {
+  size_t words[JIEBA_WORD_COUNTS_LENGTHS]; /* words of i characters */
+  size_t bytes[JIEBA_WORD_COUNTS_LENGTHS]; /* utf 8 bytes of them in total */
+  /* bit i is set if a word starts with a character of page i */
+  unsigned char first_character_pages[JIEBA_WORD_COUNTS_PAGE_BYTES];
+};
+
+void jieba_count_words(
+    const unsigned char *const *restrict words,
+    const size_t *restrict word_sizes, size_t word_count,
+    struct jieba_word_counts *restrict counts
+);
+
+size_t jieba_exact_memory_size(const struct jieba_word_counts *word_counts);
+
+enum jieba_init_result
+jieba_init_data_base_exactly(
+    struct jieba_data_base *restrict data_base, void *restrict whole_memory,
+    size_t whole_memory_size, const struct jieba_word_counts *word_counts,
+    size_t *required
+);
+
+/*
+ * Sized exactly like jieba_init_data_base_exactly, plus room to stage the
+ * words, see jieba_stage_words.
+ */
+size_t jieba_lazy_memory_size(const struct jieba_word_counts *word_counts);
+
+enum jieba_init_result
+jieba_init_data_base_lazily(
+    struct jieba_data_base *restrict data_base, void *restrict whole_memory,
+    size_t whole_memory_size, const struct jieba_word_counts *word_counts,
+    size_t *required
+);
+
 enum jieba_add_word_result {
   JIEBA_ADD_WORD_SUCCESS,
   JIEBA_ADD_WORD_FAIL_TOO_LONG,
   JIEBA_ADD_WORD_FAIL_NOMEM,
   JIEBA_ADD_WORD_FAIL_ALREADY_EXISTS,
   JIEBA_ADD_WORD_NO_ENOUGH_CHARACTER,
-  JIEBA_ADD_WORD_BAD_UTF8
+  JIEBA_ADD_WORD_BAD_UTF8,
+  JIEBA_ADD_WORD_FAIL_FROZEN
 };
 
 enum jieba_add_word_result
@@ -38,6 +105,88 @@ jieba_add_word(
     struct jieba_data_base *restrict data_base
 );
 
+/*
+ * Adds many words at once, which sizes every table once for all its words.
+ * A word already added is not a failure. On failure the index of the word is
+ * given in failed_word if it is not NULL, the words before it are added.
+ */
+enum jieba_add_word_result
+jieba_add_words(
+    const unsigned char *const *restrict words,
+    const size_t *restrict word_sizes, size_t word_count,
+    struct jieba_data_base *restrict data_base, size_t *restrict failed_word
+);
+
+/*
+ * Puts the words aside in a data base initialized lazily, the table of a
+ * length is only built from its words when it is first looked up. The words
+ * are copied, and failures are given as jieba_add_words does.
+ */
+enum jieba_add_word_result
+jieba_stage_words(
+    const unsigned char *const *restrict words,
+    const size_t *restrict word_sizes, size_t word_count,
+    struct jieba_data_base *restrict data_base, size_t *restrict failed_word
+);
+
+/* the same as jieba_add_words, with the lengths spread over the threads */
+enum jieba_add_word_result
+jieba_add_words_parallel(
+    const unsigned char *const *restrict words,
+    const size_t *restrict word_sizes, size_t word_count,
+    struct jieba_data_base *restrict data_base, size_t thread_count,
+    size_t *restrict failed_word
+);
+
+/*
+ * The frequency and the part of speech tag of a word, a tag shorter than 4
+ * bytes is padded with 0. A data base built with no JIEBA_WORD_INFO, or a
+ * trie, keeps neither, and gives 0 for both.
+ */
+struct jieba_word_info {
+  uint32_t frequency;
+  char tag[4];
+};
+
+enum jieba_add_word_result
+jieba_add_word_with_info(
+    const unsigned char *restrict word, size_t word_size,
+    const struct jieba_word_info *restrict info,
+    struct jieba_data_base *restrict data_base
+);
+
+/* returns 1 and fills info, if not NULL, if the word is in the data base */
+int jieba_find_word(
+    const unsigned char *restrict word, size_t word_size,
+    struct jieba_data_base *restrict data_base,
+    struct jieba_word_info *restrict info
+);
+
+/*
+ * Adds the words of a dictionary in the format of jieba, one word per line
+ * and optionally its frequency and tag after it, separated by spaces or tabs.
+ * A word already added is not a failure. On failure the number of the line,
+ * from 1, is given in failed_line if it is not NULL.
+ */
+enum jieba_load_dictionary_result {
+  JIEBA_LOAD_DICTIONARY_SUCCESS,
+  JIEBA_LOAD_DICTIONARY_FAIL_IO,
+  JIEBA_LOAD_DICTIONARY_FAIL_BAD_LINE,
+  JIEBA_LOAD_DICTIONARY_FAIL_ADD_WORD
+};
+
+enum jieba_load_dictionary_result
+jieba_add_dictionary(
+    const char *restrict text, size_t text_size,
+    struct jieba_data_base *restrict data_base, size_t *restrict failed_line
+);
+
+enum jieba_load_dictionary_result
+jieba_load_dictionary(
+    const char *restrict path, struct jieba_data_base *restrict data_base,
+    size_t *restrict failed_line
+);
+
 enum jieba_separate_result {
   JIEBA_SEPARATE_SUCCESS,
   JIEBA_SEPARATE_NO_ENOUGH_CHARACTER,
@@ -50,4 +199,157 @@ jieba_separate(
     struct jieba_data_base *data_base
 );
 
+/*
+ * Separates up to JIEBA_SENTENCE_LENGTH characters at the start of str into
+ * the words of the highest probability by their frequencies, the sizes of
+ * the words go to word_sizes, which has JIEBA_SENTENCE_LENGTH room, and their
+ * number to word_count. When str goes on after them, the last word is left
+ * for the next call unless it is the only one. The characters stop before a
+ * broken one, which fails only if it is the first.
+ */
+#define JIEBA_SENTENCE_LENGTH 256
+
+enum jieba_separate_result
+jieba_separate_sentence(
+    const unsigned char *restrict str, size_t strsize,
+    size_t *restrict word_sizes, size_t *restrict word_count,
+    struct jieba_data_base *restrict data_base
+);
+
+/*
+ * The hidden Markov model jieba uses for words not in the dictionary, every
+ * character is the begin, a middle or the end of a word, or a word alone.
+ * Probabilities are natural logarithms, as jieba gives them.
+ */
+enum jieba_hmm_state {
+  JIEBA_HMM_BEGIN,
+  JIEBA_HMM_MIDDLE,
+  JIEBA_HMM_END,
+  JIEBA_HMM_SINGLE,
+  JIEBA_HMM_STATE_COUNT
+};
+
+struct jieba__hmm;
+
+struct jieba_hmm {
+  char *whole_memory;
+  size_t whole_memory_size;
+  struct jieba__hmm *root;
+};
+
+size_t jieba_hmm_memory_size(size_t character_count);
+
+/* transition[i][j] is from state i to state j */
+enum jieba_init_result
+jieba_init_hmm(
+    struct jieba_hmm *restrict hmm, void *restrict whole_memory,
+    size_t whole_memory_size, size_t character_count,
+    const double start[JIEBA_HMM_STATE_COUNT],
+    const double transition[JIEBA_HMM_STATE_COUNT][JIEBA_HMM_STATE_COUNT],
+    size_t *required
+);
+
+/* a state not set for a character is as unlikely as it could be */
+enum jieba_add_word_result
+jieba_hmm_set_emission(
+    const unsigned char *restrict character, size_t character_size,
+    enum jieba_hmm_state state, double log_probability,
+    struct jieba_hmm *restrict hmm
+);
+
+/*
+ * Joins the runs of words of one character, as jieba_separate_sentence gives
+ * them, into the words the model finds for them, in place. A run that is a
+ * word of the data base is left alone.
+ */
+void jieba_hmm_join_characters(
+    const unsigned char *restrict str, size_t *restrict word_sizes,
+    size_t *restrict word_count, const struct jieba_hmm *restrict hmm,
+    struct jieba_data_base *restrict data_base
+);
+
+/*
+ * Moves what a data base uses to the front of its memory, and returns how
+ * many bytes at the end of whole_memory are not used any more. The data base
+ * keeps no spare room after it, so adding more words may fail.
+ */
+size_t jieba_compact(struct jieba_data_base *data_base);
+
+/*
+ * A frozen data base is a read only copy of a data base, whose words are
+ * looked up through perfect hash tables. Words could not be added to it. It
+ * takes no more than its whole_memory_size from the given memory, the rest
+ * of the memory is only used while freezing.
+ */
+enum jieba_freeze_result {
+  JIEBA_FREEZE_SUCCESS,
+  JIEBA_FREEZE_FAIL_NOMEM,
+  JIEBA_FREEZE_FAIL_FROZEN,
+  JIEBA_FREEZE_FAIL_NO_PERFECT_HASH
+};
+
+size_t jieba_freeze_memory_size(const struct jieba_data_base *data_base);
+
+enum jieba_freeze_result jieba_freeze_data_base(
+    struct jieba_data_base *restrict data_base,
+    struct jieba_data_base *restrict frozen_data_base,
+    void *restrict whole_memory, size_t whole_memory_size, size_t *required
+);
+
+/*
+ * A frozen data base could be saved to a file, and loaded back by mapping the
+ * file read only, which needs no other memory. An image of a saved data base
+ * in memory could be used as it is as well.
+ */
+enum jieba_save_result {
+  JIEBA_SAVE_SUCCESS,
+  JIEBA_SAVE_FAIL_NOT_FROZEN,
+  JIEBA_SAVE_FAIL_IO,
+  JIEBA_SAVE_FAIL_EXISTS
+};
+
+enum jieba_save_result jieba_save_data_base(
+    const struct jieba_data_base *data_base, const char *path
+);
+
+enum jieba_load_result {
+  JIEBA_LOAD_SUCCESS,
+  JIEBA_LOAD_FAIL_IO,
+  JIEBA_LOAD_FAIL_BAD_IMAGE,
+  JIEBA_LOAD_FAIL_INCOMPATIBLE
+};
+
+enum jieba_load_result jieba_load_data_base(
+    struct jieba_data_base *restrict data_base, const char *restrict path
+);
+
+/* unmaps a data base loaded from a file or a segment, others are untouched */
+void jieba_unload_data_base(struct jieba_data_base *data_base);
+
+enum jieba_load_result jieba_load_data_base_image(
+    struct jieba_data_base *restrict data_base, const void *restrict image,
+    size_t image_size
+);
+
+/*
+ * The same as saving and loading, with a named POSIX shared memory segment
+ * instead of a file, so processes share one copy of a data base. A segment
+ * of the name that already exists is never overwritten.
+ */
+enum jieba_save_result jieba_save_shared_data_base(
+    const struct jieba_data_base *data_base, const char *name
+);
+
+enum jieba_load_result jieba_load_shared_data_base(
+    struct jieba_data_base *restrict data_base, const char *restrict name
+);
+
+/*
+ * estimated ratio of missing words that still reach the hash tables, it is 1
+ * if there is no bloom filter
+ */
+double jieba_bloom_filter_false_positive_rate(
+    const struct jieba_data_base *data_base
+);
+
 #endif /* JIEBA_H_ */
@@ -1,4 +1,32 @@
 #!/bin/sh
 
-cc -dynamiclib jieba.c -O3 -o jieba.dylib
-cc -dynamiclib jieba.c jieba-dict.c -O3 -o jieba-dict.dylib
+cc -dynamiclib jieba.c -O3 -pthread -o jieba.dylib
+cc jieba.c jieba-dict.c jieba-dict-image.c -O3 -pthread -o jieba-dict-image
+./jieba-dict-image jieba-dict.img
+cc -dynamiclib jieba.c jieba-dict.c -O3 -pthread -DJIEBA_DICT_IMAGE=1 -o jieba-dict.dylib
+
+# the checks of jieba-test, and its output the same in every other mode
+cc jieba.c jieba-dict.c jieba-test.c -O3 -pthread -o jieba-test
+./jieba-test > jieba-test.out || exit 1
+while read mode; do
+  cc $mode jieba.c jieba-dict.c jieba-test.c -O3 -pthread -o jieba-test
+  if ! ./jieba-test > jieba-test-mode.out ||
+      ! cmp -s jieba-test-mode.out jieba-test.out; then
+    echo "jieba-test fails with $mode"
+    exit 1
+  fi
+done <<EOF
+-DJIEBA_DOUBLE_ARRAY_TRIE=1
+-DJIEBA_INCREMENTAL_PREFIX_HASH=0
+-DJIEBA_HASH_TABLE=1
+-DJIEBA_HASH_TABLE=1 -DJIEBA_SSE2=0
+-DJIEBA_HASH_TABLE_NODE_BUCKET_NUMBER=7
+-DJIEBA_BLOOM_FILTER=0
+-DJIEBA_UTF8_KEYS=0
+-DJIEBA_COMPACT_LAYOUT=0
+-DJIEBA_PACKED_KEY_MAX_LENGTH=0
+-DJIEBA_PACKED_KEY_MAX_LENGTH=6
+-DJIEBA_HASH_TABLE=2
+-DJIEBA_DICT_IMAGE=1
+EOF
+rm -f jieba-test jieba-test.out jieba-test-mode.out